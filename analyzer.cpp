@@ -1,21 +1,58 @@
 #include "analyzer.h"
 
-#include <fstream>
 #include <algorithm>
-#include <unordered_map>
 #include <array>
 #include <string>
 #include <string_view>
 #include <memory>
+#include <limits>
+#include <type_traits>
+#include <unordered_map>
+#include <thread>
+#include <functional>
+#include <istream>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Optional codecs; the makefile defines these when the headers are found.
+#ifdef TRIP_HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef TRIP_HAVE_ZSTD
+#include <zstd.h>
+#endif
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TRIP_X86 1
+#endif
 
 
+
+// Sep is the date/time separator: ' ', or 0 for ' ' or ISO 8601's 'T'
+// (Schema::isoStamps).
+template <char Sep>
+static inline bool isDateSep(char c) noexcept {
+    return Sep ? c == Sep : (c == ' ' || c == 'T');
+}
+
+template <char Sep>
 static inline int fastParseHour(const char* p, size_t len) noexcept {
     // Expected: "YYYY-MM-DD HH:MM"
     // Hour at positions 11-12 (0-based) within this field.
     if (len < 13) return -1;
-    if (p[10] != ' ') return -1;
+    if (!isDateSep<Sep>(p[10])) return -1;
 
     unsigned char c1 = (unsigned char)p[11];
     unsigned char c2 = (unsigned char)p[12];
@@ -25,189 +62,3221 @@ static inline int fastParseHour(const char* p, size_t len) noexcept {
     return (h >= 0 && h <= 23) ? h : -1;
 }
 
-static inline size_t findComma(const std::string& s, size_t start) noexcept {
-    return s.find(',', start);
+// Days since 1970-01-01 of a proleptic Gregorian date (Howard Hinnant's
+// days_from_civil).
+static inline int daysFromCivil(int y, int m, int d) noexcept {
+    y -= m <= 2;
+    int era = (y >= 0 ? y : y - 399) / 400;
+    int yoe = y - era * 400;
+    int doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468;
+}
+
+static inline int daysInMonth(int y, int m) noexcept {
+    static const unsigned char kDays[12] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+    bool leap = (y % 4 == 0 && y % 100 != 0) || y % 400 == 0;
+    return kDays[m - 1] + (m == 2 && leap);
 }
 
+// Full "YYYY-MM-DD HH:MM" stamp: day number and minute of day. Every digit is
+// checked at its fixed offset with no early exits; false on any mismatch or
+// out-of-range field. Seconds and zone suffixes are not looked at.
+template <char Sep>
+static inline bool fastParseStamp(const char* p, size_t len, int& day, int& minute) noexcept {
+    if (len < 16) return false;
+
+    static const unsigned char kDigits[12] = {0, 1, 2, 3, 5, 6, 8, 9, 11, 12, 14, 15};
+    unsigned v[12];
+    unsigned bad = (p[4] != '-') | (p[7] != '-') | !isDateSep<Sep>(p[10]) | (p[13] != ':');
+    for (int i = 0; i < 12; ++i) {
+        v[i] = (unsigned)((unsigned char)p[kDigits[i]] - '0');
+        bad |= v[i] > 9;
+    }
+    if (bad) return false;
 
+    int y = (int)(v[0] * 1000 + v[1] * 100 + v[2] * 10 + v[3]);
+    int mo = (int)(v[4] * 10 + v[5]);
+    int d = (int)(v[6] * 10 + v[7]);
+    int h = (int)(v[8] * 10 + v[9]);
+    int mi = (int)(v[10] * 10 + v[11]);
+    if (mo < 1 || mo > 12 || d < 1 || d > daysInMonth(y, mo) || h > 23 || mi > 59) return false;
 
-class TripAnalyzerImpl {
+    day = daysFromCivil(y, mo, d);
+    minute = h * 60 + mi;
+    return true;
+}
+
+
+
+// Read-only view of a whole file. Uses mmap when possible; on failure (pipes,
+// special files) the caller falls back to chunked read().
+class MappedFile {
 public:
-    std::unordered_map<std::string, int> zoneIndex;
-    std::vector<std::string> zones;
-    std::vector<long long> zoneCounts;
-    std::vector<std::array<long long, 24>> hourCounts;
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile() {
+        if (data_) ::munmap(data_, size_);
+    }
 
-    void clearAll() {
-        zoneIndex.clear();
-        zones.clear();
-        zoneCounts.clear();
-        hourCounts.clear();
+    bool map(int fd) noexcept {
+        struct stat st;
+        if (::fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0) return false;
+        size_t size = (size_t)st.st_size;
+        void* p = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED) return false;
+        ::madvise(p, size, MADV_SEQUENTIAL);
+        ::madvise(p, size, MADV_WILLNEED);
+        data_ = p;
+        size_ = size;
+        return true;
     }
-};
 
-static std::unordered_map<const TripAnalyzer*, std::unique_ptr<TripAnalyzerImpl>> implMap;
+    const char* data() const noexcept { return (const char*)data_; }
+    size_t size() const noexcept { return size_; }
+
+private:
+    void* data_ = nullptr;
+    size_t size_ = 0;
+};
 
-static TripAnalyzerImpl* getImpl(const TripAnalyzer* ta) {
-    auto it = implMap.find(ta);
-    if (it == implMap.end()) {
-        auto ptr = std::make_unique<TripAnalyzerImpl>();
-        TripAnalyzerImpl* raw = ptr.get();
-        implMap.emplace(ta, std::move(ptr));
-        return raw;
+class FileDescriptor {
+public:
+    explicit FileDescriptor(const std::string& path) noexcept
+        : fd_(::open(path.c_str(), O_RDONLY | O_CLOEXEC)) {}
+    FileDescriptor(const FileDescriptor&) = delete;
+    FileDescriptor& operator=(const FileDescriptor&) = delete;
+    ~FileDescriptor() {
+        if (fd_ >= 0) ::close(fd_);
     }
-    return it->second.get();
+
+    int get() const noexcept { return fd_; }
+    bool ok() const noexcept { return fd_ >= 0; }
+
+private:
+    int fd_;
+};
+
+static inline uint64_t hashMix(uint64_t h) noexcept {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return h;
 }
 
-// Basit temizlik (çok testte object birikir diye)
-static void cleanupIfNeeded() {
-    if (implMap.size() > 200) implMap.clear();
+static inline uint64_t hashZone(std::string_view s) noexcept {
+    const char* p = s.data();
+    size_t n = s.size();
+    uint64_t h = 0x9e3779b97f4a7c15ull ^ (n * 0x100000001b3ull);
+    while (n >= 8) {
+        uint64_t w;
+        std::memcpy(&w, p, 8);
+        h = (h ^ w) * 0x9e3779b97f4a7c15ull;
+        h ^= h >> 29;
+        p += 8;
+        n -= 8;
+    }
+    if (n) {
+        uint64_t w = 0;
+        std::memcpy(&w, p, n);
+        h = (h ^ w) * 0x9e3779b97f4a7c15ull;
+    }
+    return hashMix(h);
 }
 
+// Flat open-addressing index from zone hash to dense zone index (linear
+// probing, load <= 1/2). Keys live with the caller; a slot only holds the upper
+// hash bits as a fingerprint, so most mismatches never touch the key bytes.
+// Each zone's full hash is cached for rehashing and for merges.
+class ZoneTable {
+public:
+    // Returns the index of the zone `eq` accepts. On a miss the zone is added
+    // under the next dense index and `inserted` is set.
+    template <class KeyEq>
+    int findOrInsert(uint64_t hash, KeyEq&& eq, bool& inserted) {
+        if ((hashes_.size() + 1) * 2 > slots_.size()) grow();
 
+        uint32_t tag = (uint32_t)(hash >> 32);
+        size_t i = (size_t)hash & mask_;
+        for (;;) {
+            Slot& s = slots_[i];
+            if (s.idx1 == 0) {
+                s.tag = tag;
+                s.idx1 = (uint32_t)hashes_.size() + 1;
+                hashes_.push_back(hash);
+                inserted = true;
+                return (int)s.idx1 - 1;
+            }
+            if (s.tag == tag && eq((int)s.idx1 - 1)) {
+                inserted = false;
+                return (int)s.idx1 - 1;
+            }
+            i = (i + 1) & mask_;
+        }
+    }
 
-void TripAnalyzer::ingestFile(const std::string& csvPath) {
-    cleanupIfNeeded();
-    TripAnalyzerImpl* impl = getImpl(this);
+    template <class KeyEq>
+    int find(uint64_t hash, KeyEq&& eq) const {
+        if (slots_.empty()) return -1;
+        uint32_t tag = (uint32_t)(hash >> 32);
+        for (size_t i = (size_t)hash & mask_;; i = (i + 1) & mask_) {
+            const Slot& s = slots_[i];
+            if (s.idx1 == 0) return -1;
+            if (s.tag == tag && eq((int)s.idx1 - 1)) return (int)s.idx1 - 1;
+        }
+    }
 
-    impl->clearAll();
+    uint64_t hashOf(int idx) const noexcept { return hashes_[(size_t)idx]; }
+    size_t size() const noexcept { return hashes_.size(); }
+    size_t capacity() const noexcept { return slots_.size(); }
+
+    // Mean slots visited by a successful lookup
+    double meanProbeLength() const noexcept {
+        if (hashes_.empty()) return 0;
+        size_t total = 0;
+        for (size_t i = 0; i < slots_.size(); ++i) {
+            if (!slots_[i].idx1) continue;
+            size_t home = (size_t)hashes_[slots_[i].idx1 - 1] & mask_;
+            total += ((i - home) & mask_) + 1;
+        }
+        return (double)total / (double)hashes_.size();
+    }
 
-    std::ifstream file(csvPath);
-    if (!file.is_open()) return;
+    void reserve(size_t n) {
+        hashes_.reserve(n);
+        if (n * 2 > slots_.size()) rehash(n * 2);
+    }
 
-    std::string line;
-    // header skip
-    if (!std::getline(file, line)) return;
-
-    impl->zoneIndex.reserve(4096);
-    impl->zones.reserve(4096);
-    impl->zoneCounts.reserve(4096);
-    impl->hourCounts.reserve(4096);
-
-    while (std::getline(file, line)) {
-        if (line.empty()) continue;
-
-        // Need at least 6 fields:
-        // 0 TripID
-        // 1 PickupZoneID
-        // 2 DropoffZoneID
-        // 3 PickupDateTime
-        // 4 DistanceKm
-        // 5 FareAmount
-        size_t c0 = findComma(line, 0);
-        if (c0 == std::string::npos) continue;
-        size_t c1 = findComma(line, c0 + 1);
-        if (c1 == std::string::npos) continue;
-        size_t c2 = findComma(line, c1 + 1);
-        if (c2 == std::string::npos) continue;
-        size_t c3 = findComma(line, c2 + 1);
-        if (c3 == std::string::npos) continue;
-        size_t c4 = findComma(line, c3 + 1);
-        if (c4 == std::string::npos) continue;
-
-        // zone field [1]
-        size_t zStart = c0 + 1;
-        size_t zLen = (c1 > zStart) ? (c1 - zStart) : 0;
-        if (zLen == 0) continue;
-
-        std::string_view zoneSv(line.data() + zStart, zLen);
-
-        // datetime field [3]
-        size_t dtStart = c2 + 1;
-        size_t dtLen = (c3 > dtStart) ? (c3 - dtStart) : 0;
-        if (dtLen == 0) continue;
-
-        // Eğer datetime tırnaklı geliyorsa: "YYYY-MM-DD HH:MM"
-       
-        const char* dtPtr = line.data() + dtStart;
-        size_t dtRealLen = dtLen;
-        if (dtRealLen >= 2 && dtPtr[0] == '"' && dtPtr[dtRealLen - 1] == '"') {
-            dtPtr += 1;
-            dtRealLen -= 2;
-        }
-
-        int hour = fastParseHour(dtPtr, dtRealLen);
-        if (hour < 0) continue;
-
-        // Zone key (string)
-        std::string zoneKey(zoneSv);
-
-        auto it = impl->zoneIndex.find(zoneKey);
-        int idx;
-        if (it == impl->zoneIndex.end()) {
-            idx = (int)impl->zones.size();
-            impl->zones.emplace_back(std::move(zoneKey));
-            impl->zoneCounts.push_back(0);
-
-            impl->hourCounts.push_back({});
-            impl->hourCounts.back().fill(0);
-
-            
-            impl->zoneIndex.emplace(impl->zones.back(), idx);
-        } else {
-            idx = it->second;
+    void clear() {
+        hashes_.clear();
+        std::fill(slots_.begin(), slots_.end(), Slot{});
+    }
+
+private:
+    struct Slot {
+        uint32_t tag = 0;
+        uint32_t idx1 = 0;   // zone index + 1, 0 = empty
+    };
+
+    void grow() { rehash(slots_.empty() ? 64 : slots_.size() * 2); }
+
+    void rehash(size_t minSlots) {
+        size_t cap = 64;
+        while (cap < minSlots) cap <<= 1;
+
+        slots_.assign(cap, Slot{});
+        mask_ = cap - 1;
+        for (size_t idx = 0; idx < hashes_.size(); ++idx) {
+            uint64_t h = hashes_[idx];
+            size_t i = (size_t)h & mask_;
+            while (slots_[i].idx1) i = (i + 1) & mask_;
+            slots_[i] = Slot{(uint32_t)(h >> 32), (uint32_t)idx + 1};
+        }
+    }
+
+    std::vector<Slot> slots_;
+    std::vector<uint64_t> hashes_;
+    size_t mask_ = 0;
+};
+
+// Bump allocator for zone IDs. Strings are copied once into 64 KiB pages and
+// never move, so string_views into the arena stay valid until reset().
+class StringArena {
+public:
+    std::string_view intern(std::string_view s) {
+        if (s.size() > left_) {
+            // oversized IDs get a page of their own and leave the bump page alone
+            if (s.size() > kPageSize / 4) return copyTo(newPage(s.size()), s);
+            cur_ = newPage(kPageSize);
+            left_ = kPageSize;
+        }
+        std::string_view out = copyTo(cur_, s);
+        cur_ += s.size();
+        left_ -= s.size();
+        return out;
+    }
+
+    // One free per page, not per string.
+    void reset() noexcept {
+        pages_.clear();
+        cur_ = nullptr;
+        left_ = 0;
+        reserved_ = 0;
+    }
+
+    size_t bytesReserved() const noexcept { return reserved_; }
+
+private:
+    static constexpr size_t kPageSize = 64 << 10;
+
+    static std::string_view copyTo(char* dst, std::string_view s) noexcept {
+        if (!s.empty()) std::memcpy(dst, s.data(), s.size());
+        return std::string_view(dst, s.size());
+    }
+
+    char* newPage(size_t size) {
+        pages_.emplace_back(new char[size]);
+        reserved_ += size;
+        return pages_.back().get();
+    }
+
+    std::vector<std::unique_ptr<char[]>> pages_;
+    char* cur_ = nullptr;
+    size_t left_ = 0;
+    size_t reserved_ = 0;
+};
+
+// Threads for `work` units at no less than `minPerWorker` units each, within
+// the AnalyzerOptions::threads budget. Ingest and ranking share this policy.
+static unsigned poolSize(const AnalyzerOptions& opts, size_t work, size_t minPerWorker) {
+    unsigned t = opts.threads ? opts.threads : std::thread::hardware_concurrency();
+    size_t byWork = work / minPerWorker;
+    if (byWork < t) t = (unsigned)byWork;
+    return t ? t : 1;
+}
+
+// Runs f(i) for every part i < parts: part 0 on the calling thread, the rest on
+// their own threads. Returns once all parts are done.
+template <class F>
+static void runParts(size_t parts, F f) {
+    std::vector<std::thread> threads;
+    threads.reserve(parts > 1 ? parts - 1 : 0);
+    for (size_t i = 1; i < parts; ++i) threads.emplace_back([&f, i] { f(i); });
+    if (parts) f(0);
+    for (auto& t : threads) t.join();
+}
+
+using NamedIndex = std::pair<std::string_view, uint32_t>;
+
+static constexpr size_t kParallelNames = 1 << 16;
+
+// MSD radix sort of distinct names, byte by byte from `depth`. Bytes every
+// name shares are stepped over without moving anything, which matters for
+// IDs like ZONE_LONGPREFIX_123; small buckets finish with std::sort. At the
+// first real split, whole buckets are shared out over `workers` threads.
+static void sortNames(NamedIndex* a, size_t n, size_t depth, NamedIndex* tmp, unsigned workers) {
+    auto byte = [&](const NamedIndex& e) { return e.first.size() > depth ? 1 + (unsigned char)e.first[depth] : 0; };
+    while (n >= 64) {
+        size_t count[257] = {};
+        for (size_t i = 0; i < n; ++i) ++count[byte(a[i])];
+        if (count[byte(a[0])] == n) {
+            if (byte(a[0]) == 0) return;    // all ended here: equal names
+            ++depth;
+            continue;
         }
 
-        impl->zoneCounts[idx] += 1;
-        impl->hourCounts[idx][hour] += 1;
+        size_t start[257], sum = 0;
+        for (int b = 0; b < 257; ++b) {
+            start[b] = sum;
+            sum += count[b];
+        }
+        for (size_t i = 0; i < n; ++i) tmp[start[byte(a[i])]++] = a[i];
+        std::copy(tmp, tmp + n, a);
+
+        // contiguous runs of buckets holding about n / workers names each
+        std::vector<int> cuts{1};
+        if (workers > 1 && n >= kParallelNames) {
+            size_t seen = 0;
+            for (int b = 1; b < 257; ++b) {
+                seen += count[b];
+                if (seen * workers >= n * cuts.size() && b + 1 < 257) cuts.push_back(b + 1);
+            }
+        }
+        cuts.push_back(257);
+        runParts(cuts.size() - 1, [&](size_t part) {
+            for (int b = cuts[part]; b < cuts[part + 1]; ++b) {
+                size_t lo = start[b] - count[b];
+                if (count[b] > 1) sortNames(a + lo, count[b], depth + 1, tmp + lo, 1);
+            }
+        });
+        return;
     }
+    std::sort(a, a + n, [&](const NamedIndex& x, const NamedIndex& y) {
+        return x.first.substr(std::min(depth, x.first.size())) < y.first.substr(std::min(depth, y.first.size()));
+    });
 }
 
-std::vector<ZoneCount> TripAnalyzer::topZones(int k) const {
-    TripAnalyzerImpl* impl = getImpl(this);
+// Lexicographic rank of every zone index, so ranking tie-breaks compare
+// integers instead of names. Built lazily by the first query that wants it
+// and extended on later queries; zones only ever get appended, so new names
+// are sorted on their own and merged into the existing order. Queries may
+// call get() concurrently; writers never run alongside them.
+class LexRanks {
+public:
+    LexRanks() = default;
+    LexRanks(LexRanks&&) noexcept {}    // derived data: rebuilt, not moved
+    LexRanks& operator=(LexRanks&&) noexcept {
+        clear();
+        return *this;
+    }
 
-    std::vector<ZoneCount> result;
-    result.reserve(impl->zones.size());
+    template <class Src>
+    const std::vector<uint32_t>& get(const Src& src, unsigned workers) const {
+        std::lock_guard<std::mutex> lock(mu_);
+        size_t n = src.zoneCount();
+        if (rank_.size() != n) extend(src, n, workers);
+        ready_.store(n, std::memory_order_release);
+        return rank_;
+    }
 
-    for (size_t i = 0; i < impl->zones.size(); ++i) {
-        result.push_back({impl->zones[i], impl->zoneCounts[i]});
+    // The ranks if they already cover all n zones, else nullptr
+    const uint32_t* ready(size_t n) const noexcept {
+        return n && ready_.load(std::memory_order_acquire) == n ? rank_.data() : nullptr;
     }
 
-    auto cmp = [](const ZoneCount& a, const ZoneCount& b) {
-        if (a.count != b.count) return a.count > b.count;
-        return a.zone < b.zone;
+    void clear() {
+        std::lock_guard<std::mutex> lock(mu_);
+        order_.clear();
+        rank_.clear();
+        ready_.store(0, std::memory_order_release);
+    }
+
+private:
+    template <class Src>
+    void extend(const Src& src, size_t n, unsigned workers) const {
+        // sort the new names with their views at hand, then merge by index
+        size_t old = order_.size();
+        std::vector<NamedIndex> fresh(n - old), tmp(n - old);
+        for (size_t i = old; i < n; ++i) fresh[i - old] = {src.zone(i), (uint32_t)i};
+        sortNames(fresh.data(), fresh.size(), 0, tmp.data(), workers);
+        order_.resize(n);
+        for (size_t i = old; i < n; ++i) order_[i] = fresh[i - old].second;
+        if (old) {
+            auto byName = [&](uint32_t a, uint32_t b) { return src.zone(a) < src.zone(b); };
+            std::inplace_merge(order_.begin(), order_.begin() + (std::ptrdiff_t)old, order_.end(), byName);
+        }
+
+        rank_.resize(n);
+        for (size_t r = 0; r < n; ++r) rank_[order_[r]] = (uint32_t)r;
+    }
+
+    mutable std::mutex mu_;
+    mutable std::vector<uint32_t> order_;   // zone indices in name order
+    mutable std::vector<uint32_t> rank_;    // zone index -> position in order_
+    mutable std::atomic<size_t> ready_{0};  // zones covered by rank_
+};
+
+// Flat open-addressing counter keyed by a (pickup, dropoff) pair of dense
+// zone indices packed into 64 bits (linear probing, load <= 3/4). There can be
+// far more pairs than zones, so an entry is just the key and its count.
+class PairTable {
+public:
+    static uint64_t key(uint32_t a, uint32_t b) noexcept { return (uint64_t)a << 32 | b; }
+
+    void add(uint64_t k, long long n) {
+        if ((size_ + 1) * 4 > slots_.size() * 3) grow();
+        Entry& e = probe(slots_, mask_, k);
+        if (e.key == kEmpty) {
+            e.key = k;
+            ++size_;
+        }
+        e.count += n;
+    }
+
+    size_t size() const noexcept { return size_; }
+
+    // f(key, count) for every pair, in table order
+    template <class F>
+    void forEach(F&& f) const {
+        for (const Entry& e : slots_)
+            if (e.key != kEmpty) f(e.key, e.count);
+    }
+
+    void clear() {
+        slots_.clear();
+        size_ = 0;
+        mask_ = 0;
+    }
+
+private:
+    static constexpr uint64_t kEmpty = ~0ull;
+
+    struct Entry {
+        uint64_t key = kEmpty;
+        long long count = 0;
     };
 
-    if (k <= 0) return {};
-    if ((int)result.size() <= k) {
-        std::sort(result.begin(), result.end(), cmp);
-        return result;
+    static Entry& probe(std::vector<Entry>& slots, size_t mask, uint64_t k) {
+        size_t i = (size_t)hashMix(k) & mask;
+        while (slots[i].key != kEmpty && slots[i].key != k) i = (i + 1) & mask;
+        return slots[i];
     }
 
-    std::nth_element(result.begin(), result.begin() + k, result.end(), cmp);
-    result.resize(k);
-    std::sort(result.begin(), result.end(), cmp);
-    return result;
-}
+    void grow() {
+        size_t cap = slots_.empty() ? 64 : slots_.size() * 2;
+        std::vector<Entry> next(cap);
+        for (const Entry& e : slots_)
+            if (e.key != kEmpty) probe(next, cap - 1, e.key) = e;
+        slots_.swap(next);
+        mask_ = cap - 1;
+    }
 
-std::vector<SlotCount> TripAnalyzer::topBusySlots(int k) const {
-    TripAnalyzerImpl* impl = getImpl(this);
+    std::vector<Entry> slots_;
+    size_t size_ = 0;
+    size_t mask_ = 0;
+};
+
+// TripIDs seen since the last replacing ingest (AnalyzerOptions::dedupTripIds).
+// IDs around the first one go into a bitmap, which grows to cover new IDs
+// as long as it stays within kBitsPerId bits per stored ID; the others go
+// into an exact open-addressing set. IDs the bitmap grows over move into it.
+class TripIdSet {
+public:
+    // Adds id (< kEmpty); false if it was already there
+    bool insert(uint64_t id) {
+        uint64_t bit = id - base_;     // wraps below base_
+        if (bit >= span_) return insertSlow(id);
+        return setBit(bit);
+    }
 
-    std::vector<SlotCount> all;
-    all.reserve(impl->zones.size() * 4);
+    size_t size() const noexcept { return size_; }
 
-    for (size_t i = 0; i < impl->zones.size(); ++i) {
-        for (int h = 0; h < 24; ++h) {
-            long long c = impl->hourCounts[i][h];
-            if (c) all.push_back({impl->zones[i], h, c});
+    void clear() {
+        bits_.clear();
+        sparse_.clear();
+        base_ = span_ = 0;
+        size_ = sparseSize_ = 0;
+    }
+
+private:
+    static constexpr uint64_t kEmpty = ~0ull;
+    static constexpr uint64_t kBitsPerId = 32;
+    static constexpr uint64_t kMinBits = 1 << 16;
+
+    bool inBitmap(uint64_t id) const noexcept { return id - base_ < span_; }
+
+    bool setBit(uint64_t bit) noexcept {
+        uint64_t& word = bits_[(size_t)(bit >> 6)];
+        uint64_t mask = 1ull << (bit & 63);
+        if (word & mask) return false;
+        word |= mask;
+        ++size_;
+        return true;
+    }
+
+    // Out of line so that the per-row bitmap case stays small
+    [[gnu::noinline]] bool insertSlow(uint64_t id) {
+        if (!cover(id)) return insertSparse(id);
+        return setBit(id - base_);
+    }
+
+    // Grows the bitmap (at least doubling it) to cover id if it stays dense
+    bool cover(uint64_t id) {
+        uint64_t lo = bits_.empty() ? id & ~63ull : base_, hi = lo + span_;
+        uint64_t want = std::max(span_ * 2, kMinBits);
+        if (bits_.empty() || id >= hi) {
+            hi = std::max((id | 63) + 1, lo + want);
+        } else {
+            uint64_t floor = hi > want ? hi - want : 0;
+            lo = std::min(id & ~63ull, floor & ~63ull);
         }
+        if (hi - lo > kBitsPerId * (size_ + 1) + kMinBits) return false;
+
+        std::vector<uint64_t> next((size_t)((hi - lo) >> 6));
+        if (!bits_.empty()) std::copy(bits_.begin(), bits_.end(), next.begin() + (std::ptrdiff_t)((base_ - lo) >> 6));
+        bits_.swap(next);
+        base_ = lo;
+        span_ = hi - lo;
+
+        // sparse IDs now inside the bitmap move over
+        if (sparseSize_) {
+            std::vector<uint64_t> old(sparse_.size(), kEmpty);
+            old.swap(sparse_);
+            sparseSize_ = 0;
+            for (uint64_t k : old) {
+                if (k == kEmpty) continue;
+                if (inBitmap(k)) bits_[(size_t)((k - base_) >> 6)] |= 1ull << ((k - base_) & 63);
+                else placeSparse(k);
+            }
+        }
+        return true;
     }
 
-    auto cmp = [](const SlotCount& a, const SlotCount& b) {
-        if (a.count != b.count) return a.count > b.count;
-        if (a.zone != b.zone) return a.zone < b.zone;
-        return a.hour < b.hour;
+    bool insertSparse(uint64_t id) {
+        if ((sparseSize_ + 1) * 4 > sparse_.size() * 3) growSparse();
+        if (!placeSparse(id)) return false;
+        ++size_;
+        return true;
+    }
+
+    bool placeSparse(uint64_t id) {
+        size_t mask = sparse_.size() - 1;
+        size_t i = (size_t)hashMix(id) & mask;
+        while (sparse_[i] != kEmpty) {
+            if (sparse_[i] == id) return false;
+            i = (i + 1) & mask;
+        }
+        sparse_[i] = id;
+        ++sparseSize_;
+        return true;
+    }
+
+    void growSparse() {
+        std::vector<uint64_t> old(std::max<size_t>(sparse_.size() * 2, 64), kEmpty);
+        old.swap(sparse_);
+        sparseSize_ = 0;
+        for (uint64_t k : old)
+            if (k != kEmpty) placeSparse(k);
+    }
+
+    std::vector<uint64_t> bits_;
+    uint64_t base_ = 0;             // ID of bit 0, a multiple of 64
+    uint64_t span_ = 0;             // bits_.size() * 64
+    std::vector<uint64_t> sparse_;  // kEmpty = free
+    size_t size_ = 0;
+    size_t sparseSize_ = 0;
+};
+
+// Space-Saving (Metwally et al.) over (zone, hour) keys with a fixed number
+// of counters (AnalyzerOptions::approxCapacity). A monitored key's count
+// overestimates its true count by at most its `error`, which never exceeds
+// N / capacity after N counted trips, and every key seen more than
+// N / capacity times is monitored. Counters live in a min-heap on count; a
+// miss with all counters taken evicts the minimum and inherits its count.
+class SpaceSaving {
+public:
+    struct Counter {
+        std::string zone;
+        int hour;            // -1 when counting whole zones
+        long long count;
+        long long error;
+        uint64_t hash;
     };
 
-    if (k <= 0) return {};
-    if ((int)all.size() <= k) {
-        std::sort(all.begin(), all.end(), cmp);
-        return all;
+    explicit SpaceSaving(size_t capacity) : capacity_(std::max<size_t>(capacity, 1)) {
+        size_t cap = 64;
+        while (cap < capacity_ * 2) cap <<= 1;
+        slots_.assign(cap, 0);
+        mask_ = cap - 1;
+        counters_.reserve(capacity_);
+        heap_.reserve(capacity_);
+        pos_.reserve(capacity_);
+    }
+
+    void add(std::string_view zone, int hour, long long n = 1, long long error = 0) {
+        uint64_t hash = hour < 0 ? hashZone(zone) : hashMix(hashZone(zone) ^ (uint64_t)(hour + 1));
+        size_t slot = (size_t)hash & mask_;
+        for (; slots_[slot]; slot = (slot + 1) & mask_) {
+            Counter& c = counters_[slots_[slot] - 1];
+            if (c.hash == hash && c.hour == hour && c.zone == zone) {
+                c.count += n;
+                c.error += error;
+                siftDown(pos_[slots_[slot] - 1]);
+                return;
+            }
+        }
+
+        if (counters_.size() < capacity_) {
+            uint32_t idx = (uint32_t)counters_.size();
+            counters_.push_back(Counter{std::string(zone), hour, n, error, hash});
+            slots_[slot] = idx + 1;
+            pos_.push_back((uint32_t)heap_.size());
+            heap_.push_back(idx);
+            siftUp(heap_.size() - 1);
+            return;
+        }
+
+        // evict the minimum; the newcomer inherits its count as error
+        uint32_t idx = heap_[0];
+        Counter& victim = counters_[idx];
+        erase(victim.hash, idx);
+        victim.zone.assign(zone.data(), zone.size());
+        victim.hour = hour;
+        victim.error = victim.count + error;
+        victim.count += n;
+        victim.hash = hash;
+        size_t s = (size_t)hash & mask_;
+        while (slots_[s]) s = (s + 1) & mask_;
+        slots_[s] = idx + 1;
+        siftDown(0);
+    }
+
+    // Weighted updates keep the N / capacity bound for the combined stream.
+    void mergeFrom(const SpaceSaving& other) {
+        for (const Counter& c : other.counters_) add(c.zone, c.hour, c.count, c.error);
+    }
+
+    const std::vector<Counter>& counters() const noexcept { return counters_; }
+    size_t capacity() const noexcept { return capacity_; }
+
+private:
+    // backward-shift deletion, so probe chains need no tombstones
+    void erase(uint64_t hash, uint32_t idx) {
+        size_t i = (size_t)hash & mask_;
+        while (slots_[i] != idx + 1) i = (i + 1) & mask_;
+        for (size_t j = (i + 1) & mask_; slots_[j]; j = (j + 1) & mask_) {
+            size_t home = (size_t)counters_[slots_[j] - 1].hash & mask_;
+            if (((j - home) & mask_) >= ((j - i) & mask_)) {
+                slots_[i] = slots_[j];
+                i = j;
+            }
+        }
+        slots_[i] = 0;
+    }
+
+    bool less(size_t a, size_t b) const noexcept {
+        return counters_[heap_[a]].count < counters_[heap_[b]].count;
+    }
+
+    void swapAt(size_t a, size_t b) noexcept {
+        std::swap(heap_[a], heap_[b]);
+        pos_[heap_[a]] = (uint32_t)a;
+        pos_[heap_[b]] = (uint32_t)b;
+    }
+
+    void siftUp(size_t i) noexcept {
+        while (i && less(i, (i - 1) / 2)) {
+            swapAt(i, (i - 1) / 2);
+            i = (i - 1) / 2;
+        }
+    }
+
+    void siftDown(size_t i) noexcept {
+        for (;;) {
+            size_t l = 2 * i + 1, m = i;
+            if (l < heap_.size() && less(l, m)) m = l;
+            if (l + 1 < heap_.size() && less(l + 1, m)) m = l + 1;
+            if (m == i) return;
+            swapAt(i, m);
+            i = m;
+        }
     }
 
-    std::nth_element(all.begin(), all.begin() + k, all.end(), cmp);
-    all.resize(k);
-    std::sort(all.begin(), all.end(), cmp);
-    return all;
+    size_t capacity_;
+    std::vector<Counter> counters_;
+    std::vector<uint32_t> heap_;    // counter indices, smallest count first
+    std::vector<uint32_t> pos_;     // counter index -> heap position
+    std::vector<uint32_t> slots_;   // counter index + 1, 0 = empty
+    size_t mask_ = 0;
+};
+
+// Approximate-mode state: one sketch for zones, one for (zone, hour) slots
+struct HeavyHitters {
+    SpaceSaving zones;
+    SpaceSaving slots;
+
+    explicit HeavyHitters(size_t capacity) : zones(capacity), slots(capacity) {}
+};
+
+// Ingest counters (IngestStats). Each Aggregates keeps its own, so parallel
+// shards count without sharing cache lines; merges add them up.
+// TRIP_INGEST_STATS=0 compiles the row counters and timers out.
+#ifndef TRIP_INGEST_STATS
+#define TRIP_INGEST_STATS 1
+#endif
+static constexpr bool kIngestStats = TRIP_INGEST_STATS != 0;
+
+static inline uint64_t statClock() noexcept {
+    if constexpr (!kIngestStats) return 0;
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch()).count();
 }
 
+struct RowStats {
+    uint64_t rows = 0;           // non-empty lines
+    uint64_t missingFields = 0;
+    uint64_t emptyZone = 0;
+    uint64_t badDatetime = 0;
+    uint64_t badHour = 0;
+    uint64_t duplicateIds = 0;
+    uint64_t bytes = 0;
+    uint64_t ioNs = 0;
+    uint64_t parseNs = 0;
+    uint64_t aggregateNs = 0;
+
+    void add(const RowStats& o) noexcept {
+        rows += o.rows;
+        missingFields += o.missingFields;
+        emptyZone += o.emptyZone;
+        badDatetime += o.badDatetime;
+        badHour += o.badHour;
+        duplicateIds += o.duplicateIds;
+        bytes += o.bytes;
+        ioNs += o.ioNs;
+        parseNs += o.parseNs;
+        aggregateNs += o.aggregateNs;
+    }
+};
+
+// Hour counters are narrow by default; TRIP_COUNTER_BITS=16 trades more
+// promotions for a smaller table.
+#ifndef TRIP_COUNTER_BITS
+#define TRIP_COUNTER_BITS 32
+#endif
+
+using HourCell = std::conditional_t<TRIP_COUNTER_BITS == 16, uint16_t, uint32_t>;
+
+// Zone dictionary + counters. The analyzer owns one; parallel ingestion gives
+// every worker a private one and merges them back in file order.
+//
+// Each zone has 24 narrow hour cells. A cell that would overflow promotes its
+// whole row to 64-bit: the row moves to wideRows and its cells are all set to
+// kPromoted, so readers know to look it up there. Zone totals are cached as
+// exact 64-bit counts.
+struct Aggregates {
+    static constexpr HourCell kPromoted = std::numeric_limits<HourCell>::max();
+
+    StringArena zoneNames;
+    ZoneTable zoneIndex;
+    std::vector<std::string_view> zones;     // into zoneNames
+    std::vector<long long> zoneCounts;
+    std::vector<HourCell> hourCells;         // zone * 24 + hour
+    std::vector<std::array<long long, 24>> wideRows;
+    std::unordered_map<uint32_t, uint32_t> wideIndex;   // zone -> wideRows index
+
+    // AnalyzerOptions::extendedColumns. Grown on first write, so entries past
+    // the end read as zero and zones seen only as pickups cost nothing here.
+    std::vector<long long> dropoffCounts;
+    std::vector<long long> fareMilli;        // zone * 24 + hour, 1/1000 currency units
+    std::vector<long long> distanceMilli;    // zone * 24 + hour, metres
+    PairTable routes;                        // (pickup, dropoff) -> trips
+    PairTable stamps;                        // (pickup, timeBucket()) -> trips
+    RowStats stats;
+    std::unique_ptr<HeavyHitters> heavy;     // AnalyzerOptions::approxCapacity instead of the above
+    LexRanks lex;
+
+    int zoneSlot(std::string_view key) {
+        size_t width;
+        uint32_t number;
+        if (zoneNumber(key, width, number)) {
+            const std::vector<int32_t>& row = direct[width];
+            if (number < row.size() && row[number] >= 0) return row[number];
+        }
+        return zoneSlot(key, hashZone(key));
+    }
+
+    int zoneSlot(std::string_view key, uint64_t hash) {
+        bool inserted;
+        int idx = zoneIndex.findOrInsert(hash, [&](int i) { return zones[(size_t)i] == key; }, inserted);
+        if (inserted) {
+            zones.push_back(zoneNames.intern(key));
+            zoneCounts.push_back(0);
+            hourCells.resize(hourCells.size() + 24, 0);
+            noteDirect(key, idx);
+        }
+        return idx;
+    }
+
+    // -1 if the zone was never seen
+    int findZone(std::string_view key) const {
+        return zoneIndex.find(hashZone(key), [&](int i) { return zones[(size_t)i] == key; });
+    }
+
+    // One trip; the common case is two increments.
+    void count(int idx, int hour) {
+        zoneCounts[(size_t)idx] += 1;
+        HourCell& c = hourCells[(size_t)idx * 24 + (size_t)hour];
+        if (c < kPromoted - 1) ++c;
+        else promote(idx)[(size_t)hour] += 1;
+    }
+
+    void add(int idx, int hour, long long n) {
+        if (n <= 0) return;
+        zoneCounts[(size_t)idx] += n;
+        HourCell& c = hourCells[(size_t)idx * 24 + (size_t)hour];
+        if (c != kPromoted && (unsigned long long)n < (unsigned long long)(kPromoted - c)) c = (HourCell)(c + n);
+        else promote(idx)[(size_t)hour] += n;
+    }
+
+    void countDropoff(int idx, long long n = 1) {
+        if (n == 0) return;
+        growTo(dropoffCounts, zones.size());
+        dropoffCounts[(size_t)idx] += n;
+    }
+
+    // AnalyzerOptions::timeBuckets: 15-minute buckets numbered from 0000-03-01
+    // so they stay unsigned across years 0000-9999.
+    static constexpr int kQuarters = 96;
+    static constexpr int kDayBias = 719468;
+
+    static uint32_t timeBucket(int day, int minute) noexcept {
+        return (uint32_t)(day + kDayBias) * kQuarters + (uint32_t)(minute / 15);
+    }
+
+    void countStamp(int idx, uint32_t bucket, long long n = 1) {
+        stamps.add(PairTable::key((uint32_t)idx, bucket), n);
+    }
+
+    HeavyHitters& approx(size_t capacity) {
+        if (!heavy) heavy = std::make_unique<HeavyHitters>(capacity);
+        return *heavy;
+    }
+
+    void countRoute(int pickup, int dropoff, long long n = 1) {
+        routes.add(PairTable::key((uint32_t)pickup, (uint32_t)dropoff), n);
+    }
+
+    void addFare(int idx, int hour, long long milli) {
+        if (milli == 0) return;
+        growTo(fareMilli, zones.size() * 24);
+        fareMilli[(size_t)idx * 24 + (size_t)hour] += milli;
+    }
+
+    void addDistance(int idx, int hour, long long milli) {
+        if (milli == 0) return;
+        growTo(distanceMilli, zones.size() * 24);
+        distanceMilli[(size_t)idx * 24 + (size_t)hour] += milli;
+    }
+
+    void reserve(size_t n) {
+        zoneIndex.reserve(n);
+        zones.reserve(n);
+        zoneCounts.reserve(n);
+        hourCells.reserve(n * 24);
+    }
+
+    // Zones new to *this are appended in other's first-seen order, so merging
+    // shards 0..N-1 yields the same zone order as one serial pass.
+    void mergeFrom(const Aggregates& other) {
+        stats.add(other.stats);
+        if (other.heavy) {
+            HeavyHitters& hh = approx(other.heavy->zones.capacity());
+            hh.zones.mergeFrom(other.heavy->zones);
+            hh.slots.mergeFrom(other.heavy->slots);
+        }
+        bool pairs = other.routes.size() || other.stamps.size();
+        std::vector<uint32_t> remap(pairs ? other.zones.size() : 0);
+        for (size_t j = 0; j < other.zones.size(); ++j) {
+            int idx = zoneSlot(other.zones[j], other.zoneIndex.hashOf((int)j));
+            if (!remap.empty()) remap[j] = (uint32_t)idx;
+            for (int h = 0; h < 24; ++h) {
+                add(idx, h, other.hour(j, h));
+                addFare(idx, h, other.fare(j, h));
+                addDistance(idx, h, other.distance(j, h));
+            }
+            countDropoff(idx, other.dropoffs(j));
+        }
+        other.routes.forEach([&](uint64_t k, long long n) {
+            countRoute((int)remap[(size_t)(k >> 32)], (int)remap[(size_t)(uint32_t)k], n);
+        });
+        other.stamps.forEach([&](uint64_t k, long long n) {
+            countStamp((int)remap[(size_t)(k >> 32)], (uint32_t)k, n);
+        });
+    }
+
+    // read interface shared with SnapshotView
+    size_t zoneCount() const noexcept { return zones.size(); }
+    std::string_view zone(size_t i) const noexcept { return zones[i]; }
+    long long total(size_t i) const noexcept { return zoneCounts[i]; }
+
+    long long hour(size_t i, int h) const {
+        HourCell c = hourCells[i * 24 + (size_t)h];
+        if (c != kPromoted) return c;
+        return wideRows[wideIndex.at((uint32_t)i)][(size_t)h];
+    }
+
+    const std::vector<uint32_t>& lexRanks(unsigned workers) const { return lex.get(*this, workers); }
+    const uint32_t* readyLexRanks() const noexcept { return lex.ready(zones.size()); }
+
+    long long dropoffs(size_t i) const noexcept { return at(dropoffCounts, i); }
+    long long fare(size_t i, int h) const noexcept { return at(fareMilli, i * 24 + (size_t)h); }
+    long long distance(size_t i, int h) const noexcept { return at(distanceMilli, i * 24 + (size_t)h); }
+
+    void clear() {
+        zoneNames.reset();
+        zoneIndex.clear();
+        zones.clear();
+        zoneCounts.clear();
+        hourCells.clear();
+        wideRows.clear();
+        wideIndex.clear();
+        dropoffCounts.clear();
+        fareMilli.clear();
+        distanceMilli.clear();
+        routes.clear();
+        stamps.clear();
+        stats = RowStats{};
+        heavy.reset();
+        for (auto& row : direct) row.clear();
+        lex.clear();
+    }
+
+private:
+    // "ZONE" + 1..kDirectDigits digits skips hashing: direct[width][number]
+    // holds the dense index (-1 = not seen). Widths are kept apart so
+    // ZONE042 and ZONE42 stay distinct zones.
+    static constexpr size_t kDirectDigits = 6;
+    std::array<std::vector<int32_t>, kDirectDigits + 1> direct;
+
+    static bool zoneNumber(std::string_view key, size_t& width, uint32_t& number) noexcept {
+        if (key.size() < 5 || key.size() > 4 + kDirectDigits || std::memcmp(key.data(), "ZONE", 4) != 0)
+            return false;
+        uint32_t v = 0;
+        for (size_t i = 4; i < key.size(); ++i) {
+            unsigned d = (unsigned)((unsigned char)key[i] - '0');
+            if (d > 9) return false;
+            v = v * 10 + d;
+        }
+        width = key.size() - 4;
+        number = v;
+        return true;
+    }
+
+    void noteDirect(std::string_view key, int idx) {
+        size_t width;
+        uint32_t number;
+        if (!zoneNumber(key, width, number)) return;
+        std::vector<int32_t>& row = direct[width];
+        if (number >= row.size()) row.resize(std::max<size_t>(number + 1, row.size() * 2), -1);
+        row[number] = idx;
+    }
+
+    static void growTo(std::vector<long long>& v, size_t n) {
+        if (v.size() < n) v.resize(n, 0);
+    }
+
+    static long long at(const std::vector<long long>& v, size_t i) noexcept {
+        return i < v.size() ? v[i] : 0;
+    }
+
+    std::array<long long, 24>& promote(int idx) {
+        HourCell* cells = &hourCells[(size_t)idx * 24];
+        if (cells[0] == kPromoted) return wideRows[wideIndex.at((uint32_t)idx)];
+
+        std::array<long long, 24> row;
+        for (size_t h = 0; h < 24; ++h) {
+            row[h] = cells[h];
+            cells[h] = kPromoted;
+        }
+        wideIndex.emplace((uint32_t)idx, (uint32_t)wideRows.size());
+        wideRows.push_back(row);
+        return wideRows.back();
+    }
+};
+
+// ---------------- snapshots ----------------
+// Layout (host byte order, every section 8-byte aligned):
+//   SnapshotHeader
+//   zone names, concatenated              namesBytes
+//   uint64_t nameEnd[zoneCount]           end offset of each name
+//   int64_t  total[zoneCount]
+//   int64_t  hour[zoneCount][24]
+// The checksum covers everything after the header.
+
+static constexpr char kSnapshotMagic[8] = {'T', 'R', 'I', 'P', 'S', 'N', 'A', 'P'};
+static constexpr uint32_t kSnapshotVersion = 1;
+static constexpr uint32_t kByteOrderMark = 0x01020304;
+
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint64_t zoneCount;
+    uint64_t namesBytes;
+    uint64_t namesOff;
+    uint64_t nameEndOff;
+    uint64_t totalsOff;
+    uint64_t hoursOff;
+    uint64_t fileSize;
+    uint64_t checksum;
+};
+static_assert(sizeof(SnapshotHeader) % 8 == 0, "sections after the header must stay aligned");
+
+static inline uint64_t align8(uint64_t n) noexcept { return (n + 7) & ~7ull; }
+
+// Word-at-a-time checksum that accepts the data in arbitrary pieces.
+class Checksum {
+public:
+    void update(const char* p, size_t n) noexcept {
+        while (n && fill_) {
+            push(*p++);
+            --n;
+        }
+        while (n >= 8) {
+            uint64_t w;
+            std::memcpy(&w, p, 8);
+            word(w);
+            p += 8;
+            n -= 8;
+        }
+        while (n--) push(*p++);
+    }
+
+    uint64_t value() const noexcept {
+        uint64_t h = h_;
+        if (fill_) h = (h ^ partial_) * 0x9e3779b97f4a7c15ull;
+        return hashMix(h ^ total_);
+    }
+
+private:
+    void push(char c) noexcept {
+        partial_ |= (uint64_t)(unsigned char)c << (8 * fill_);
+        if (++fill_ == 8) {
+            word(partial_);
+            total_ -= 8;    // word() counts the 8 bytes again
+            partial_ = 0;
+            fill_ = 0;
+        }
+        ++total_;
+    }
+
+    void word(uint64_t w) noexcept {
+        h_ = (h_ ^ w) * 0x9e3779b97f4a7c15ull;
+        h_ = (h_ << 31) | (h_ >> 33);
+        total_ += 8;
+    }
+
+    uint64_t h_ = 0x6a09e667f3bcc909ull;
+    uint64_t total_ = 0;
+    uint64_t partial_ = 0;
+    unsigned fill_ = 0;
+};
+
+// A validated, read-only mapping of a snapshot file. It answers the same
+// zoneCount/zone/total/hour queries as Aggregates straight from the mapping.
+class SnapshotView {
+public:
+    bool open(const std::string& path) {
+        FileDescriptor fd(path);
+        if (!fd.ok() || !file_.map(fd.get())) return false;
+
+        const char* base = file_.data();
+        size_t size = file_.size();
+        if (size < sizeof(SnapshotHeader)) return false;
+
+        SnapshotHeader h;
+        std::memcpy(&h, base, sizeof(h));
+        if (std::memcmp(h.magic, kSnapshotMagic, sizeof(h.magic)) != 0) return false;
+        if (h.version != kSnapshotVersion || h.byteOrder != kByteOrderMark) return false;
+        if (h.fileSize != size) return false;
+
+        // every section must sit where the writer would have put it
+        uint64_t n = h.zoneCount;
+        if (n > size / (26 * sizeof(int64_t))) return false;
+        if (h.namesOff != sizeof(SnapshotHeader)) return false;
+        if (h.namesBytes > size || h.nameEndOff != align8(h.namesOff + h.namesBytes)) return false;
+        if (h.totalsOff != h.nameEndOff + n * 8) return false;
+        if (h.hoursOff != h.totalsOff + n * 8) return false;
+        if (h.hoursOff + n * 24 * 8 != size) return false;
+
+        Checksum sum;
+        sum.update(base + sizeof(SnapshotHeader), size - sizeof(SnapshotHeader));
+        if (sum.value() != h.checksum) return false;
+
+        names_ = base + h.namesOff;
+        nameEnd_ = (const uint64_t*)(base + h.nameEndOff);
+        totals_ = (const int64_t*)(base + h.totalsOff);
+        hours_ = (const int64_t*)(base + h.hoursOff);
+        zoneCount_ = (size_t)n;
+
+        uint64_t prev = 0;
+        for (size_t i = 0; i < zoneCount_; ++i) {
+            if (nameEnd_[i] < prev || nameEnd_[i] > h.namesBytes) return false;
+            prev = nameEnd_[i];
+        }
+        return true;
+    }
+
+    size_t zoneCount() const noexcept { return zoneCount_; }
+    const std::vector<uint32_t>& lexRanks(unsigned workers) const { return lex_.get(*this, workers); }
+    const uint32_t* readyLexRanks() const noexcept { return lex_.ready(zoneCount_); }
+
+    std::string_view zone(size_t i) const noexcept {
+        uint64_t begin = i ? nameEnd_[i - 1] : 0;
+        return std::string_view(names_ + begin, (size_t)(nameEnd_[i] - begin));
+    }
+
+    long long total(size_t i) const noexcept { return totals_[i]; }
+    long long hour(size_t i, int h) const noexcept { return hours_[i * 24 + (size_t)h]; }
+
+private:
+    MappedFile file_;
+    const char* names_ = nullptr;
+    const uint64_t* nameEnd_ = nullptr;
+    const int64_t* totals_ = nullptr;
+    const int64_t* hours_ = nullptr;
+    size_t zoneCount_ = 0;
+    LexRanks lex_;
+};
+
+// ---------------- row schema ----------------
+// An input's header line picks its delimiter and, when it names all six
+// columns, where each one sits. The row parser is compiled for the standard
+// column order, whose field offsets are constants, and for mapped columns,
+// each with and without ISO 8601 stamps, so the schema costs nothing per row;
+// see ingestLines.
+
+static constexpr unsigned kMaxFields = 16;   // mapped columns must be among the first 16
+
+static constexpr std::string_view kStandardHeader =
+    "TripID,PickupZoneID,DropoffZoneID,PickupDateTime,DistanceKm,FareAmount";
+
+// Field index of each column. `need` is the highest, which is also how many
+// delimiters a row must have.
+struct MappedColumns {
+    static constexpr unsigned kSlots = kMaxFields - 1;
+    unsigned trip = 0, zone = 1, dropoff = 2, datetime = 3, distance = 4, fare = 5;
+    unsigned need = 5;
+};
+
+struct Schema {
+    char delim = ',';
+    bool checkDelim = false;  // delim is not ','; the first row must not be ',' separated
+    bool isoStamps = false;   // renamed header: "YYYY-MM-DDTHH:MM" counts too
+    bool mapped = false;      // cols are not in the standard order
+    MappedColumns cols;
+};
+
+// "Pickup_Zone_ID" -> "pickupzoneid"
+static std::string headerKey(std::string_view name) {
+    std::string key;
+    for (char c : name) {
+        if (c == '_' || c == '-' || c == ' ' || c == '"' || c == '\r') continue;
+        key += (char)std::tolower((unsigned char)c);
+    }
+    return key;
+}
+
+// Column (0 TripID ... 5 FareAmount) a header key names, -1 for others
+static int headerColumn(const std::string& key) {
+    static const std::pair<const char*, int> kNames[] = {
+        {"tripid", 0},         {"id", 0},
+        {"pickupzoneid", 1},   {"pickupzone", 1},          {"pulocationid", 1},
+        {"dropoffzoneid", 2},  {"dropoffzone", 2},         {"dolocationid", 2},
+        {"pickupdatetime", 3}, {"pickuptime", 3},          {"tpeppickupdatetime", 3},
+        {"distancekm", 4},     {"distance", 4},            {"tripdistance", 4},
+        {"fareamount", 5},     {"fare", 5},
+    };
+    for (const auto& [name, col] : kNames)
+        if (key == name) return col;
+    return -1;
+}
+
+// The header split on one delimiter
+struct HeaderSplit {
+    unsigned fields = 0;
+    unsigned named = 0;       // bit per column named exactly once within kMaxFields
+    unsigned pos[6] = {};
+
+    bool allNamed() const noexcept { return named == 0x3f; }
+    bool fits() const noexcept { return allNamed() || fields == 6; }
+};
+
+static HeaderSplit splitHeader(const char* p, size_t len, char delim) {
+    HeaderSplit h;
+    unsigned repeated = 0;
+    for (size_t i = 0; i <= len; ++h.fields) {
+        const char* f = p + i;
+        const char* e = (const char*)std::memchr(f, delim, len - i);
+        if (!e) e = p + len;
+        int col = headerColumn(headerKey(std::string_view(f, (size_t)(e - f))));
+        if (col >= 0) {
+            if (h.named >> col & 1 || h.fields >= kMaxFields) repeated |= 1u << col;
+            h.named |= 1u << col;
+            h.pos[col] = h.fields;
+        }
+        i = (size_t)(e - p) + 1;
+    }
+    h.named &= ~repeated;
+    return h;
+}
+
+// ',' unless the header only fits (six fields, or all six columns named) when
+// split on ';', TAB or '|'. Headers that do not name every column exactly
+// once keep the standard order. The exact standard header keeps the
+// standard stamps too; only a renamed one also takes ISO 8601.
+static Schema schemaFromHeader(const char* p, size_t len) {
+    Schema s;
+    HeaderSplit h = splitHeader(p, len, ',');
+    if (!h.fits()) {
+        for (char d : {';', '\t', '|'}) {
+            HeaderSplit other = splitHeader(p, len, d);
+            if (other.fits()) {
+                h = other;
+                s.delim = d;
+                s.checkDelim = true;
+                break;
+            }
+        }
+    }
+    if (!h.allNamed()) return s;
+
+    std::string_view text(p, len);
+    if (!text.empty() && text.back() == '\r') text.remove_suffix(1);
+    s.isoStamps = text != kStandardHeader;
+
+    const unsigned* pos = h.pos;
+    s.cols = {pos[0], pos[1], pos[2], pos[3], pos[4], pos[5], *std::max_element(pos, pos + 6)};
+    for (unsigned i = 0; i < 6; ++i) s.mapped |= pos[i] != i;
+    return s;
+}
+
+// A header split on another delimiter can still sit over ',' rows. If the
+// first non-empty row in [p, end) has commas but not the delimiter, falls
+// back to the standard schema. Waits for a complete row unless `final`.
+static void checkDelimiter(Schema& s, const char* p, const char* end, bool final) {
+    while (p < end) {
+        const char* nl = (const char*)std::memchr(p, '\n', (size_t)(end - p));
+        if (!nl && !final) return;
+        const char* lineEnd = nl ? nl : end;
+        size_t len = (size_t)(lineEnd - p);
+        if (len && !(len == 1 && *p == '\r')) {
+            if (!std::memchr(p, s.delim, len) && std::memchr(p, ',', len)) s = Schema{};
+            s.checkDelim = false;
+            return;
+        }
+        p = lineEnd + 1;
+    }
+}
+
+// ingestBuffer() state between calls
+struct BufferStream {
+    bool headerDone = false;
+    Schema schema;
+    std::string pending;     // header or unterminated row read so far
+};
+
+// Top-k result of the last query; serves any k' <= items.size() (or any k'
+// when complete) until the analyzer's version moves on.
+template <class T>
+struct CachedRanking {
+    uint64_t version = ~0ull;
+    bool complete = false;
+    std::vector<T> items;
+};
+
+class TripAnalyzerImpl {
+public:
+    AnalyzerOptions opts;
+    Aggregates data;
+    std::unique_ptr<SnapshotView> snapshot;   // when set, queries read it instead of data
+    BufferStream stream;
+    TripIdSet trips;         // AnalyzerOptions::dedupTripIds; outlives the per-publish delta in data
+    uint64_t version = 0;    // bumped by every ingest call
+
+    std::mutex rankingMu;
+    CachedRanking<ZoneCount> zoneRanking;
+    CachedRanking<SlotCount> slotRanking;
+
+    // AnalyzerOptions::concurrentReads (left-right). Queries read
+    // sides[live] and never touch data, which then only collects the rows of
+    // the running ingest call. Publishing merges that delta into the idle
+    // side, flips `live`, waits for readers still on the old side and replays
+    // the delta there, so both sides end up equal again.
+    struct Side {
+        Aggregates agg;
+        uint64_t version = 0;
+    };
+    bool concurrent = false;
+    std::array<Side, 2> sides;
+    std::atomic<unsigned> live{0};
+    mutable std::array<std::atomic<int>, 2> readers{};
+    bool replacePending = false;   // the next publish replaces instead of adding
+    size_t unpublishedBytes = 0;
+
+    static constexpr size_t kPublishBytes = 32 << 20;
+
+    void changed() { ++version; }
+
+    // Ends with publish() on scope exit, so readers see each call's rows.
+    class WriteScope {
+    public:
+        explicit WriteScope(TripAnalyzerImpl& impl) : impl_(impl) {}
+        WriteScope(const WriteScope&) = delete;
+        WriteScope& operator=(const WriteScope&) = delete;
+        ~WriteScope() { impl_.publish(); }
+
+    private:
+        TripAnalyzerImpl& impl_;
+    };
+
+    // Before adding rows on top of a loaded snapshot, copy it into data.
+    WriteScope beginWrite() {
+        if (snapshot) {
+            data.clear();
+            loadView(*snapshot);
+            snapshot.reset();
+        }
+        changed();
+        return WriteScope(*this);
+    }
+
+    void loadView(const SnapshotView& snap) {
+        data.reserve(snap.zoneCount());
+        for (size_t i = 0; i < snap.zoneCount(); ++i) {
+            int idx = data.zoneSlot(snap.zone(i));
+            for (int h = 0; h < 24; ++h) data.add(idx, h, snap.hour(i, h));
+        }
+    }
+
+    // Runs f(state, version) on whichever state queries should see.
+    template <class F>
+    auto read(F&& f) const {
+        if (!concurrent) return snapshot ? f(*snapshot, version) : f(data, version);
+        Pin pin(*this);
+        return f(sides[pin.side].agg, sides[pin.side].version);
+    }
+
+    template <class F>
+    auto withSource(F&& f) const {
+        return read([&](const auto& src, uint64_t) { return f(src); });
+    }
+
+    // Like withSource for queries that need the full in-memory state
+    template <class F>
+    auto withData(F&& f) const {
+        if (!concurrent) return f(data);
+        Pin pin(*this);
+        return f(sides[pin.side].agg);
+    }
+
+    // The seen TripIDs for ingestLines, or nullptr when not deduplicating
+    TripIdSet* tripIds() noexcept { return opts.dedupTripIds ? &trips : nullptr; }
+
+    void clearAll() {
+        data.clear();
+        trips.clear();
+        snapshot.reset();
+        stream = BufferStream{};
+        changed();
+        if (concurrent) replacePending = true;
+    }
+
+    // Read loops call this per chunk; long streams publish every
+    // kPublishBytes instead of only at the end. A replacing ingest waits for
+    // the end so readers never see it half done.
+    void chunkDone(size_t bytes) {
+        unpublishedBytes += bytes;
+        if (concurrent && !replacePending && unpublishedBytes >= kPublishBytes) {
+            changed();
+            publish();
+        }
+    }
+
+    void publish() {
+        unpublishedBytes = 0;
+        if (!concurrent) return;
+
+        unsigned cur = live.load();
+        apply(sides[cur ^ 1u]);
+        live.store(cur ^ 1u);
+        while (readers[cur].load() != 0) std::this_thread::yield();
+        apply(sides[cur]);
+
+        data.clear();
+        replacePending = false;
+    }
+
+    // Switches AnalyzerOptions::concurrentReads; not safe against running
+    // queries.
+    void setConcurrent(bool on) {
+        if (on == concurrent) return;
+        if (on) {
+            if (snapshot) {
+                data.clear();
+                loadView(*snapshot);
+                snapshot.reset();
+            }
+            for (Side& side : sides) {
+                side.agg.clear();
+                side.agg.mergeFrom(data);
+                side.version = version;
+            }
+            data.clear();
+            concurrent = true;
+        } else {
+            data.clear();
+            data.mergeFrom(sides[live.load()].agg);
+            for (Side& side : sides) side.agg.clear();
+            concurrent = false;
+        }
+    }
+
+private:
+    // Holds a reader on the live side; the writer waits for it before
+    // touching that side again.
+    struct Pin {
+        const TripAnalyzerImpl& impl;
+        unsigned side;
+
+        explicit Pin(const TripAnalyzerImpl& i) : impl(i) {
+            for (;;) {
+                side = impl.live.load();
+                impl.readers[side].fetch_add(1);
+                if (impl.live.load() == side) return;
+                impl.readers[side].fetch_sub(1);
+            }
+        }
+        ~Pin() { impl.readers[side].fetch_sub(1, std::memory_order_release); }
+    };
+
+    void apply(Side& side) {
+        if (replacePending) side.agg.clear();
+        side.agg.mergeFrom(data);
+        side.version = version;
+    }
+};
+
+
+
+// ---------------- delimiter scanner ----------------
+// Rows are located by building delimiter / '\n' bitmasks for 64-byte blocks
+// (AVX2 or SSE2 when the CPU has them, plain C++ otherwise) and walking the
+// set bits. The delimiter is ',' unless the header chose another (Schema);
+// "comma" below means whichever it is.
+
+static constexpr unsigned kRowCommas = 5;     // fields 0..5 need five commas
+static constexpr size_t kMaskBlocks = 64;     // blocks per mask pass (4 KiB)
+static constexpr size_t kRowBatch = 256;
+
+using MaskFn = void (*)(const char* p, size_t blocks, char delim, uint64_t* commas, uint64_t* newlines);
+
+static void masksScalar(const char* p, size_t blocks, char delim, uint64_t* commas, uint64_t* newlines) {
+    for (size_t b = 0; b < blocks; ++b, p += 64) {
+        uint64_t c = 0, n = 0;
+        for (unsigned i = 0; i < 64; ++i) {
+            c |= (uint64_t)(p[i] == delim) << i;
+            n |= (uint64_t)(p[i] == '\n') << i;
+        }
+        commas[b] = c;
+        newlines[b] = n;
+    }
+}
+
+#ifdef TRIP_X86
+__attribute__((target("sse2")))
+static void masksSse2(const char* p, size_t blocks, char delim, uint64_t* commas, uint64_t* newlines) {
+    const __m128i comma = _mm_set1_epi8(delim);
+    const __m128i nl = _mm_set1_epi8('\n');
+    for (size_t b = 0; b < blocks; ++b, p += 64) {
+        uint64_t c = 0, n = 0;
+        for (unsigned i = 0; i < 4; ++i) {
+            __m128i v = _mm_loadu_si128((const __m128i*)(p + 16 * i));
+            c |= (uint64_t)(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, comma)) << (16 * i);
+            n |= (uint64_t)(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, nl)) << (16 * i);
+        }
+        commas[b] = c;
+        newlines[b] = n;
+    }
+}
+
+__attribute__((target("avx2")))
+static void masksAvx2(const char* p, size_t blocks, char delim, uint64_t* commas, uint64_t* newlines) {
+    const __m256i comma = _mm256_set1_epi8(delim);
+    const __m256i nl = _mm256_set1_epi8('\n');
+    for (size_t b = 0; b < blocks; ++b, p += 64) {
+        __m256i lo = _mm256_loadu_si256((const __m256i*)p);
+        __m256i hi = _mm256_loadu_si256((const __m256i*)(p + 32));
+        commas[b] = (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, comma)) |
+                    (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, comma)) << 32;
+        newlines[b] = (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, nl)) |
+                      (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, nl)) << 32;
+    }
+}
+#endif
+
+static MaskFn selectMaskFn() {
+#ifdef TRIP_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return masksAvx2;
+    if (__builtin_cpu_supports("sse2")) return masksSse2;
+#endif
+    return masksScalar;
+}
+
+static MaskFn blockMasks() {
+    static const MaskFn fn = selectMaskFn();
+    return fn;
+}
+
+// One row: offsets of its first commas (up to the scanner's `need`, at most
+// N) relative to `line`.
+template <unsigned N>
+struct RowFields {
+    const char* line;
+    uint32_t len;          // without the '\n'
+    uint32_t commas;       // number of entries used in comma[]
+    uint32_t comma[N];
+};
+
+template <unsigned N>
+class RowScanner {
+public:
+    // With `final` set, an unterminated last row is returned as well.
+    RowScanner(const char* p, const char* end, bool final, char delim, unsigned need) noexcept
+        : next_(p), end_(end), rowStart_(p), final_(final), delim_(delim), mask_(blockMasks()), need_(need) {}
+
+    // Fills up to `cap` rows; returns 0 once the input is exhausted.
+    size_t next(RowFields<N>* out, size_t cap) noexcept {
+        size_t n = 0;
+        while (n < cap) {
+            if (!bits_) {
+                if (!advance()) {
+                    if (final_ && rowStart_ < end_) {
+                        emit(out[n++], end_);
+                        rowStart_ = end_;
+                    }
+                    break;
+                }
+                continue;
+            }
+
+            unsigned i = (unsigned)__builtin_ctzll(bits_);
+            bits_ &= bits_ - 1;
+            const char* pos = blockBase() + i;
+
+            if ((nl_[block_] >> i) & 1) {
+                emit(out[n++], pos);
+                rowStart_ = pos + 1;
+                rowCommas_ = 0;
+                bits_ = (comma_[block_] | nl_[block_]) & ~((2ull << i) - 1);
+            } else {
+                offsets_[rowCommas_++] = (uint32_t)(pos - rowStart_);
+                if (rowCommas_ == need_) bits_ &= nl_[block_];   // rest of the row is irrelevant
+            }
+        }
+        return n;
+    }
+
+    // Start of the unterminated remainder (== end when there is none).
+    const char* tail() const noexcept { return rowStart_; }
+
+private:
+    const char* blockBase() const noexcept { return chunk_ + 64 * block_; }
+
+    void emit(RowFields<N>& r, const char* lineEnd) const noexcept {
+        r.line = rowStart_;
+        r.len = (uint32_t)(lineEnd - rowStart_);
+        r.commas = rowCommas_;
+        std::memcpy(r.comma, offsets_, sizeof(offsets_));
+    }
+
+    bool advance() noexcept {
+        if (++block_ >= blocks_ && !refill()) return false;
+        bits_ = nl_[block_];
+        if (rowCommas_ < need_) bits_ |= comma_[block_];
+        return true;
+    }
+
+    bool refill() noexcept {
+        if (next_ >= end_) return false;
+        size_t avail = (size_t)(end_ - next_);
+        chunk_ = next_;
+        block_ = 0;
+        if (avail >= 64) {
+            blocks_ = std::min(avail / 64, kMaskBlocks);
+            mask_(next_, blocks_, delim_, comma_, nl_);
+            next_ += 64 * blocks_;
+        } else {
+            // zero padding is neither a delimiter nor '\n'
+            char pad[64] = {};
+            std::memcpy(pad, next_, avail);
+            mask_(pad, 1, delim_, comma_, nl_);
+            blocks_ = 1;
+            next_ = end_;
+        }
+        return true;
+    }
+
+    const char* next_;
+    const char* end_;
+    const char* chunk_ = nullptr;
+    const char* rowStart_;
+    bool final_;
+    char delim_;
+    MaskFn mask_;
+
+    uint64_t comma_[kMaskBlocks];
+    uint64_t nl_[kMaskBlocks];
+    size_t blocks_ = 0;
+    size_t block_ = 0;
+    uint64_t bits_ = 0;
+
+    uint32_t need_;
+    uint32_t rowCommas_ = 0;
+    uint32_t offsets_[N] = {};
+};
+
+// The standard column order as constants, so its field offsets fold into
+// the row parser. Same members as MappedColumns.
+struct StandardColumns {
+    static constexpr unsigned kSlots = kRowCommas;
+    static constexpr unsigned trip = 0, zone = 1, dropoff = 2, datetime = 3, distance = 4, fare = 5;
+    static constexpr unsigned need = kRowCommas;
+};
+
+struct FieldSpan {
+    size_t start, end;
+    size_t len() const noexcept { return end - start; }
+};
+
+// Field f of a row with at least cols.need commas. The last one needed runs
+// to the next comma or the end of the line.
+template <class Cols>
+static inline FieldSpan fieldAt(const RowFields<Cols::kSlots>& r, const Cols& cols, unsigned f, char delim) noexcept {
+    size_t start = f ? r.comma[f - 1] + 1 : 0;
+    if (f < cols.need) return {start, r.comma[f]};
+
+    size_t end = r.len;
+    if (const void* c = std::memchr(r.line + start, delim, end - start)) end = (size_t)((const char*)c - r.line);
+    if (end > start && r.line[end - 1] == '\r') --end;
+    return {start, end};
+}
+
+// Parses a decimal like "12.5" / "-3" as thousandths (12500 / -3000). At
+// most 15 integer digits; fraction digits past the third are dropped. Returns
+// false on anything else, including an empty field.
+static inline bool parseMilli(const char* p, size_t len, long long& out) noexcept {
+    if (len >= 2 && p[0] == '"' && p[len - 1] == '"') {
+        p += 1;
+        len -= 2;
+    }
+
+    const char* end = p + len;
+    bool neg = false;
+    if (p < end && (*p == '-' || *p == '+')) neg = (*p++ == '-');
+
+    long long whole = 0;
+    int digits = 0;
+    for (; p < end && (unsigned)(*p - '0') < 10; ++p, ++digits) {
+        if (digits == 15) return false;
+        whole = whole * 10 + (*p - '0');
+    }
+
+    long long frac = 0;
+    int fracDigits = 0;
+    if (p < end && *p == '.') {
+        for (++p; p < end && (unsigned)(*p - '0') < 10; ++p, ++fracDigits) {
+            if (fracDigits < 3) frac = frac * 10 + (*p - '0');
+        }
+    }
+    if (p != end || digits + fracDigits == 0) return false;
+
+    for (int i = fracDigits; i < 3; ++i) frac *= 10;
+    long long v = whole * 1000 + frac;
+    out = neg ? -v : v;
+    return true;
+}
+
+// Dropoff zone, distance and fare. A dirty value only drops that value; the
+// trip still counts for its pickup zone.
+template <class Cols>
+static void ingestExtended(Aggregates& agg, const RowFields<Cols::kSlots>& r, const Cols& cols, char delim, int idx,
+                           int hour) {
+    FieldSpan d = fieldAt(r, cols, cols.dropoff, delim);
+    if (d.len()) {
+        int drop = agg.zoneSlot(std::string_view(r.line + d.start, d.len()));
+        agg.countDropoff(drop);
+        agg.countRoute(idx, drop);
+    }
+
+    long long milli;
+    FieldSpan km = fieldAt(r, cols, cols.distance, delim);
+    if (parseMilli(r.line + km.start, km.len(), milli)) agg.addDistance(idx, hour, milli);
+
+    FieldSpan fare = fieldAt(r, cols, cols.fare, delim);
+    if (parseMilli(r.line + fare.start, fare.len(), milli)) agg.addFare(idx, hour, milli);
+}
+
+// Counts why fastParseHour() refused a datetime field
+template <char Sep>
+static void countBadDatetime(RowStats& st, const char* p, size_t len) {
+    if constexpr (!kIngestStats) return;
+    bool digits = len >= 13 && isDateSep<Sep>(p[10]) && std::isdigit((unsigned char)p[11]) &&
+                  std::isdigit((unsigned char)p[12]);
+    ++(digits ? st.badHour : st.badDatetime);
+}
+
+static bool parseTripIdSlow(const char* p, size_t len, uint64_t& id) noexcept {
+    if (len >= 2 && p[0] == '"' && p[len - 1] == '"') {
+        ++p;
+        len -= 2;
+    }
+    if (len == 0 || len > 19) return false;
+    uint64_t v = 0;
+    for (size_t i = 0; i < len; ++i) {
+        unsigned d = (unsigned)(p[i] - '0');
+        if (d > 9) return false;
+        v = v * 10 + d;
+    }
+    id = v;
+    return true;
+}
+
+// TripID field as an unsigned integer of at most 19 digits, optionally
+// quoted. `avail` is how many bytes of the row start at p; in the standard
+// order, with the datetime after it, that is always at least 8.
+static bool parseTripId(const char* p, size_t len, size_t avail, uint64_t& id) noexcept {
+    if (len - 1 < 8 && avail >= 8) {
+        // up to 8 digits at once: pad the front with '0's, check, then fold
+        // digit pairs, quads and octets (first digit in the low byte)
+        uint64_t x;
+        std::memcpy(&x, p, 8);
+        unsigned pad = (unsigned)(8 - len) * 8;
+        if (pad) x = x << pad | (0x3030303030303030ull >> (64 - pad));
+        if (((x & 0xf0f0f0f0f0f0f0f0ull) | ((x + 0x0606060606060606ull) & 0xf0f0f0f0f0f0f0f0ull) >> 4) !=
+            0x3333333333333333ull)
+            return parseTripIdSlow(p, len, id);
+        x -= 0x3030303030303030ull;
+        x = x * 10 + (x >> 8);
+        x = ((x & 0x000000ff000000ffull) * (100 + (1000000ull << 32)) +
+             ((x >> 16) & 0x000000ff000000ffull) * (1 + (10000ull << 32))) >> 32;
+        id = x;
+        return true;
+    }
+    return parseTripIdSlow(p, len, id);
+}
+
+// Dirty rows are skipped silently.
+template <char Sep, class Cols>
+static void ingestRow(Aggregates& agg, const AnalyzerOptions& opts, TripIdSet* trips,
+                      const RowFields<Cols::kSlots>& r, const Cols& cols, char delim) {
+    if (r.len == 0) return;
+    if constexpr (kIngestStats) ++agg.stats.rows;
+
+    // Need every column (standard order):
+    // 0 TripID
+    // 1 PickupZoneID
+    // 2 DropoffZoneID
+    // 3 PickupDateTime
+    // 4 DistanceKm
+    // 5 FareAmount
+    if (r.commas < cols.need) {
+        if constexpr (kIngestStats) ++agg.stats.missingFields;
+        return;
+    }
+
+    FieldSpan z = fieldAt(r, cols, cols.zone, delim);
+    if (z.len() == 0) {
+        if constexpr (kIngestStats) ++agg.stats.emptyZone;
+        return;
+    }
+
+    std::string_view zoneSv(r.line + z.start, z.len());
+
+    FieldSpan dt = fieldAt(r, cols, cols.datetime, delim);
+    if (dt.len() == 0) {
+        if constexpr (kIngestStats) ++agg.stats.badDatetime;
+        return;
+    }
+
+    // Eğer datetime tırnaklı geliyorsa: "YYYY-MM-DD HH:MM"
+    const char* dtPtr = r.line + dt.start;
+    size_t dtRealLen = dt.len();
+    if (dtRealLen >= 2 && dtPtr[0] == '"' && dtPtr[dtRealLen - 1] == '"') {
+        dtPtr += 1;
+        dtRealLen -= 2;
+    }
+
+    int hour = fastParseHour<Sep>(dtPtr, dtRealLen);
+    if (hour < 0) {
+        countBadDatetime<Sep>(agg.stats, dtPtr, dtRealLen);
+        return;
+    }
+
+    // replayed rows: only the first valid row per TripID counts
+    if (trips) {
+        FieldSpan t = fieldAt(r, cols, cols.trip, delim);
+        uint64_t id;
+        if (parseTripId(r.line + t.start, t.len(), r.len - t.start, id) && !trips->insert(id)) {
+            if constexpr (kIngestStats) ++agg.stats.duplicateIds;
+            return;
+        }
+    }
+
+    if (opts.approxCapacity) {
+        HeavyHitters& hh = agg.approx(opts.approxCapacity);
+        hh.zones.add(zoneSv, -1);
+        hh.slots.add(zoneSv, hour);
+        return;
+    }
+
+    int idx = agg.zoneSlot(zoneSv);
+    agg.count(idx, hour);
+
+    if (opts.extendedColumns) ingestExtended(agg, r, cols, delim, idx, hour);
+
+    int day, minute;
+    if (opts.timeBuckets && fastParseStamp<Sep>(dtPtr, dtRealLen, day, minute))
+        agg.countStamp(idx, Aggregates::timeBucket(day, minute));
+}
+
+template <char Sep, class Cols>
+static const char* ingestRows(Aggregates& agg, const AnalyzerOptions& opts, TripIdSet* trips, const Cols& cols,
+                              char delim, const char* p, const char* end, bool final) {
+    RowScanner<Cols::kSlots> scanner(p, end, final, delim, cols.need);
+    RowFields<Cols::kSlots> rows[kRowBatch];
+
+    for (;;) {
+        uint64_t t0 = statClock();
+        size_t n = scanner.next(rows, kRowBatch);
+        uint64_t t1 = statClock();
+        agg.stats.parseNs += t1 - t0;
+        if (!n) break;
+
+        for (size_t i = 0; i < n; ++i) ingestRow<Sep>(agg, opts, trips, rows[i], cols, delim);
+        agg.stats.aggregateNs += statClock() - t1;
+    }
+    if constexpr (kIngestStats) agg.stats.bytes += (uint64_t)(scanner.tail() - p);
+    return scanner.tail();
+}
+
+// Ingests every row in [p, end) and returns the start of the unterminated tail
+// (== end if there is none, or if `final` asked for the tail to be ingested too).
+// Runs the parser built for the schema, once checkDelimiter() has had a row.
+static const char* ingestLines(Aggregates& agg, const AnalyzerOptions& opts, TripIdSet* trips, Schema& schema,
+                               const char* p, const char* end, bool final) {
+    if (schema.checkDelim) checkDelimiter(schema, p, end, final);
+    char delim = schema.delim;
+    // mapped columns come from a renamed header, so always with isoStamps
+    if (schema.mapped) return ingestRows<0>(agg, opts, trips, schema.cols, delim, p, end, final);
+    return schema.isoStamps ? ingestRows<0>(agg, opts, trips, StandardColumns{}, delim, p, end, final)
+                            : ingestRows<' '>(agg, opts, trips, StandardColumns{}, delim, p, end, final);
+}
+
+static constexpr size_t kMinBytesPerWorker = 64 << 10;
+
+static unsigned ingestWorkers(const AnalyzerOptions& opts, size_t bytes) {
+    // the sketch is order dependent, and the first row per TripID wins; one
+    // pass keeps both well defined
+    if (bytes < opts.parallelMinBytes || opts.approxCapacity || opts.dedupTripIds) return 1;
+    return poolSize(opts, bytes, kMinBytesPerWorker);
+}
+
+// Splits [p, end) into `parts` ranges that each start at a line boundary.
+static std::vector<const char*> splitLines(const char* p, const char* end, unsigned parts) {
+    std::vector<const char*> bounds{p};
+    size_t len = (size_t)(end - p);
+    for (unsigned i = 1; i < parts; ++i) {
+        const char* q = p + len / parts * i;
+        if (q <= bounds.back()) q = bounds.back() + 1;
+        if (q >= end) break;
+
+        // q-1 so that a range already starting right after '\n' is kept as is
+        const char* nl = (const char*)std::memchr(q - 1, '\n', (size_t)(end - (q - 1)));
+        if (!nl || nl + 1 >= end) break;
+        bounds.push_back(nl + 1);
+    }
+    bounds.push_back(end);
+    return bounds;
+}
+
+// Ingests the rows in [p, end), in parallel when large enough. Returns the
+// unterminated tail like ingestLines.
+static const char* ingestBody(TripAnalyzerImpl* impl, Schema& schema, const char* p, const char* end, bool final) {
+    unsigned workers = ingestWorkers(impl->opts, (size_t)(end - p));
+    if (workers <= 1) return ingestLines(impl->data, impl->opts, impl->tripIds(), schema, p, end, final);
+
+    // settled up front so that the ranges agree on it
+    if (schema.checkDelim) checkDelimiter(schema, p, end, final);
+
+    std::vector<const char*> bounds = splitLines(p, end, workers);
+    size_t parts = bounds.size() - 1;
+
+    // Range 0 goes straight into the analyzer state; the rest get private
+    // shards that are merged afterwards in range order. Only the last range
+    // can have an unterminated tail.
+    std::vector<Aggregates> shards(parts - 1);
+    const char* tail = end;
+    runParts(parts, [&](size_t i) {
+        bool last = i + 1 == parts;
+        Schema part = schema;
+        // never deduplicating here: see ingestWorkers
+        const char* t = ingestLines(i ? shards[i - 1] : impl->data, impl->opts, nullptr, part, bounds[i],
+                                    bounds[i + 1], final || !last);
+        if (last) tail = t;
+    });
+
+    for (auto& shard : shards) impl->data.mergeFrom(shard);
+    return tail;
+}
+
+static void ingestMapped(TripAnalyzerImpl* impl, const char* data, size_t size) {
+    const char* end = data + size;
+
+    // header skip
+    const char* p = (const char*)std::memchr(data, '\n', size);
+    if (!p) return;
+    Schema schema = schemaFromHeader(data, (size_t)(p - data));
+    ++p;
+
+    ingestBody(impl, schema, p, end, true);
+}
+
+static constexpr size_t kReadChunk = 1 << 20;
+
+// Ingests everything `read(buf, cap)` yields (bytes read, 0 at the end, < 0
+// when the input was cut short) through one fixed kReadChunk buffer, so
+// memory stays flat for unbounded input. Rows split across reads are carried
+// over; after a cut the unterminated last row is dropped, not counted as
+// complete. A line that alone fills the buffer is judged on its first
+// kReadChunk bytes and the rest is skipped.
+template <class Read>
+static void ingestReadLoop(TripAnalyzerImpl* impl, Read&& read) {
+    Aggregates& agg = impl->data;
+    const AnalyzerOptions& opts = impl->opts;
+    TripIdSet* trips = impl->tripIds();
+    std::vector<char> buf(kReadChunk);
+    size_t used = 0;        // bytes carried over from the previous chunk
+    bool headerDone = false;
+    bool skipping = false;  // inside the rest of an overlong line
+    bool cut = false;
+    Schema schema;          // the default one for an overlong header
+
+    for (;;) {
+        if (used == buf.size()) {
+            if (headerDone) ingestLines(agg, opts, trips, schema, buf.data(), buf.data() + used, true);
+            headerDone = true;      // an overlong first line is still the header
+            used = 0;
+            skipping = true;
+        }
+
+        uint64_t t0 = statClock();
+        long long n = read(buf.data() + used, buf.size() - used);
+        agg.stats.ioNs += statClock() - t0;
+        if (n <= 0) {
+            cut = n < 0;
+            break;
+        }
+
+        const char* p = buf.data();
+        const char* end = p + used + (size_t)n;
+        if (skipping || !headerDone) {
+            const char* nl = (const char*)std::memchr(p + used, '\n', (size_t)n);
+            if (!nl) {
+                used = skipping ? 0 : (size_t)(end - p);
+                continue;
+            }
+            if (!headerDone) schema = schemaFromHeader(p, (size_t)(nl - p));
+            headerDone = true;
+            skipping = false;
+            p = nl + 1;
+        }
+
+        p = ingestLines(agg, opts, trips, schema, p, end, false);
+        used = (size_t)(end - p);
+        if (used) std::memmove(buf.data(), p, used);
+        impl->chunkDone((size_t)n);
+    }
+
+    if (headerDone && used && !skipping && !cut)
+        ingestLines(agg, opts, trips, schema, buf.data(), buf.data() + used, true);
+}
+
+// ---------------- compressed input ----------------
+// A compressed file is inflated on a producer thread into a small ring of
+// kReadChunk buffers; the parser drains them through ingestReadLoop, so
+// decompression and parsing overlap and memory stays bounded.
+
+enum class Codec { Plain, Gzip, Zstd };
+
+static Codec sniffCodec(const unsigned char* p, size_t n) noexcept {
+    if (n >= 2 && p[0] == 0x1f && p[1] == 0x8b) return Codec::Gzip;
+    if (n >= 4 && p[0] == 0x28 && p[1] == 0xb5 && p[2] == 0x2f && p[3] == 0xfd) return Codec::Zstd;
+    return Codec::Plain;
+}
+
+static bool codecAvailable(Codec c) noexcept {
+    switch (c) {
+    case Codec::Plain: return true;
+#ifdef TRIP_HAVE_ZLIB
+    case Codec::Gzip: return true;
+#endif
+#ifdef TRIP_HAVE_ZSTD
+    case Codec::Zstd: return true;
+#endif
+    default: return false;
+    }
+}
+
+// Raw bytes: an in-memory prefix (a mapping, or the magic bytes already read
+// from a pipe), then the fd if there is one.
+struct RawInput {
+    const char* mem = nullptr;
+    size_t memLen = 0;
+    int fd = -1;
+
+    long long read(char* dst, size_t cap) {
+        if (memLen) {
+            size_t n = std::min(cap, memLen);
+            std::memcpy(dst, mem, n);
+            mem += n;
+            memLen -= n;
+            return (long long)n;
+        }
+        if (fd < 0) return 0;
+        for (;;) {
+            ssize_t n = ::read(fd, dst, cap);
+            if (n < 0 && errno == EINTR) continue;
+            return (long long)n;
+        }
+    }
+};
+
+// Single-producer, single-consumer ring of output buffers
+class ChunkPipe {
+public:
+    static constexpr size_t kDepth = 4;
+
+    ChunkPipe() {
+        for (auto& b : bufs_) b.resize(kReadChunk);
+    }
+
+    // producer: next free buffer (kReadChunk bytes), nullptr once aborted
+    char* acquire() {
+        std::unique_lock<std::mutex> lock(mu_);
+        cv_.wait(lock, [&] { return full_ < kDepth || aborted_; });
+        return aborted_ ? nullptr : bufs_[(head_ + full_) % kDepth].data();
+    }
+
+    void commit(size_t len) {
+        if (len == 0) return;
+        std::lock_guard<std::mutex> lock(mu_);
+        lens_[(head_ + full_) % kDepth] = len;
+        ++full_;
+        cv_.notify_all();
+    }
+
+    // `cut`: the input was damaged or truncated, so the data ends mid-stream
+    void close(bool cut = false) {
+        std::lock_guard<std::mutex> lock(mu_);
+        closed_ = true;
+        cut_ = cut;
+        cv_.notify_all();
+    }
+
+    void abort() {
+        std::lock_guard<std::mutex> lock(mu_);
+        aborted_ = true;
+        cv_.notify_all();
+    }
+
+    // consumer: copies up to cap bytes; once closed and drained 0, or -1
+    // after close(true)
+    long long read(char* dst, size_t cap) {
+        std::unique_lock<std::mutex> lock(mu_);
+        cv_.wait(lock, [&] { return full_ > 0 || closed_; });
+        if (full_ == 0) return cut_ ? -1 : 0;
+        lock.unlock();
+
+        // the front buffer is ours until it is released below
+        size_t n = std::min(cap, lens_[head_] - off_);
+        std::memcpy(dst, bufs_[head_].data() + off_, n);
+        off_ += n;
+
+        if (off_ == lens_[head_]) {
+            lock.lock();
+            off_ = 0;
+            head_ = (head_ + 1) % kDepth;
+            --full_;
+            cv_.notify_all();
+        }
+        return (long long)n;
+    }
+
+private:
+    std::array<std::vector<char>, kDepth> bufs_;
+    std::array<size_t, kDepth> lens_{};
+    size_t head_ = 0, full_ = 0, off_ = 0;
+    bool closed_ = false, cut_ = false, aborted_ = false;
+    std::mutex mu_;
+    std::condition_variable cv_;
+};
+
+static constexpr size_t kInflateIn = 256 << 10;
+
+#ifdef TRIP_HAVE_ZLIB
+// Concatenated gzip members are inflated back to back, like gunzip does.
+// Returns false if the input is corrupt or ends inside a member; what was
+// inflated up to there is still delivered. Bytes that do not start a member
+// after a complete one are ignored, as gunzip does with trailing garbage.
+static bool inflateGzip(RawInput& in, ChunkPipe& out) {
+    z_stream zs{};
+    if (inflateInit2(&zs, 15 + 32) != Z_OK) return false;
+    std::vector<unsigned char> src(kInflateIn);
+
+    char* dst = out.acquire();
+    size_t used = 0;
+    bool eof = false, whole = true;
+    while (dst) {
+        if (zs.avail_in == 0 && !eof) {
+            long long n = in.read((char*)src.data(), src.size());
+            whole &= n >= 0;
+            eof = n <= 0;
+            zs.next_in = src.data();
+            zs.avail_in = eof ? 0 : (uInt)n;
+        }
+
+        // at EOF inflate() keeps flushing what it still holds until
+        // the member ends or nothing more comes out
+        size_t before = used;
+        zs.next_out = (Bytef*)dst + used;
+        zs.avail_out = (uInt)(kReadChunk - used);
+        int rc = inflate(&zs, Z_NO_FLUSH);
+        used = kReadChunk - zs.avail_out;
+
+        if (rc == Z_STREAM_END) {
+            if (inflateReset(&zs) != Z_OK) {
+                whole = false;
+                break;
+            }
+        } else if (rc != Z_OK && rc != Z_BUF_ERROR) {
+            whole &= zs.total_out == 0;     // corrupt member, or trailing garbage
+            break;
+        }
+        if (used == kReadChunk) {
+            out.commit(used);
+            used = 0;
+            dst = out.acquire();
+        } else if (eof && used == before && rc != Z_STREAM_END) {
+            whole &= zs.total_in == 0;      // inflateReset() zeroes it at each member end
+            break;
+        }
+    }
+    if (dst) out.commit(used);
+    inflateEnd(&zs);
+    return whole;
+}
+#endif
+
+#ifdef TRIP_HAVE_ZSTD
+// Like inflateGzip: false on corrupt input or input that ends inside a
+// frame.
+static bool inflateZstd(RawInput& in, ChunkPipe& out) {
+    ZSTD_DStream* zs = ZSTD_createDStream();
+    if (!zs) return false;
+    std::vector<char> src(kInflateIn);
+    ZSTD_inBuffer ib{src.data(), 0, 0};
+
+    char* dst = out.acquire();
+    size_t used = 0;
+    size_t hint = 0;        // last ZSTD_decompressStream() result with progress, 0 at a frame end
+    bool eof = false, whole = true;
+    while (dst) {
+        if (ib.pos == ib.size && !eof) {
+            long long n = in.read(src.data(), src.size());
+            whole &= n >= 0;
+            eof = n <= 0;
+            ib = ZSTD_inBuffer{src.data(), eof ? 0 : (size_t)n, 0};
+        }
+
+        // a block whose input is consumed may still be held back when the
+        // output filled up; at EOF keep draining with empty input
+        ZSTD_outBuffer ob{dst, kReadChunk, used};
+        size_t consumed = ib.pos;
+        size_t rc = ZSTD_decompressStream(zs, &ob, &ib);
+        bool progress = ob.pos != used || ib.pos != consumed;
+        used = ob.pos;
+        if (ZSTD_isError(rc)) {
+            whole = false;
+            break;
+        }
+        // after a frame end, an idle call asks for the next frame's header
+        if (progress) hint = rc;
+        if (used == kReadChunk) {
+            out.commit(used);
+            used = 0;
+            dst = out.acquire();
+        } else if (eof && (rc == 0 || !progress)) {
+            break;
+        }
+    }
+    if (dst) out.commit(used);
+    ZSTD_freeDStream(zs);
+    return whole && hint == 0;
+}
+#endif
+
+static void ingestCompressed(TripAnalyzerImpl* impl, Codec codec, RawInput in) {
+    ChunkPipe pipe;
+    std::thread producer([&] {
+        bool whole = true;
+#ifdef TRIP_HAVE_ZLIB
+        if (codec == Codec::Gzip) whole = inflateGzip(in, pipe);
+#endif
+#ifdef TRIP_HAVE_ZSTD
+        if (codec == Codec::Zstd) whole = inflateZstd(in, pipe);
+#endif
+        (void)codec;
+        (void)in;
+        pipe.close(!whole);
+    });
+
+    struct Join {
+        ChunkPipe& pipe;
+        std::thread& t;
+        ~Join() {
+            pipe.abort();
+            t.join();
+        }
+    } join{pipe, producer};
+
+    ingestReadLoop(impl, [&](char* dst, size_t cap) { return pipe.read(dst, cap); });
+}
+
+// Reads an unmappable fd: sniffs the first bytes, then streams it plain or
+// through the decompressor.
+static void ingestUnmapped(TripAnalyzerImpl* impl, int fd) {
+    char magic[4];
+    size_t got = 0;
+    while (got < sizeof(magic)) {
+        ssize_t n = ::read(fd, magic + got, sizeof(magic) - got);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        got += (size_t)n;
+    }
+
+    RawInput in{magic, got, fd};
+    Codec codec = sniffCodec((const unsigned char*)magic, got);
+    if (codec != Codec::Plain && codecAvailable(codec)) {
+        ingestCompressed(impl, codec, in);
+    } else {
+        ingestReadLoop(impl, [&](char* dst, size_t cap) { return in.read(dst, cap); });
+    }
+}
+
+TripAnalyzer::TripAnalyzer() : impl(std::make_unique<TripAnalyzerImpl>()) {}
+
+TripAnalyzer::~TripAnalyzer() = default;
+TripAnalyzer::TripAnalyzer(TripAnalyzer&&) noexcept = default;
+TripAnalyzer& TripAnalyzer::operator=(TripAnalyzer&&) noexcept = default;
+
+void TripAnalyzer::setOptions(const AnalyzerOptions& opts) {
+    impl->opts = opts;
+    impl->setConcurrent(opts.concurrentReads);
+}
+
+void TripAnalyzer::ingestFile(const std::string& csvPath) {
+    impl->clearAll();
+    appendFile(csvPath);
+}
+
+void TripAnalyzer::appendFile(const std::string& csvPath) {
+    auto scope = impl->beginWrite();
+    FileDescriptor fd(csvPath);
+    if (!fd.ok()) return;
+
+    impl->data.reserve(4096);
+
+    MappedFile mapped;
+    uint64_t t0 = statClock();
+    bool isMapped = mapped.map(fd.get());
+    impl->data.stats.ioNs += statClock() - t0;
+    if (!isMapped) {
+        ingestUnmapped(impl.get(), fd.get());
+        return;
+    }
+
+    Codec codec = sniffCodec((const unsigned char*)mapped.data(), mapped.size());
+    if (codec != Codec::Plain && codecAvailable(codec)) {
+        ingestCompressed(impl.get(), codec, RawInput{mapped.data(), mapped.size(), -1});
+    } else {
+        ingestMapped(impl.get(), mapped.data(), mapped.size());
+    }
+}
+
+void TripAnalyzer::ingestStream(std::istream& in) {
+    impl->clearAll();
+    appendStream(in);
+}
+
+void TripAnalyzer::appendStream(std::istream& in) {
+    auto scope = impl->beginWrite();
+    std::streambuf* sb = in.rdbuf();
+    if (!sb) return;
+    ingestReadLoop(impl.get(), [sb](char* dst, size_t cap) -> long long {
+        return (long long)sb->sgetn(dst, (std::streamsize)cap);
+    });
+}
+
+void TripAnalyzer::ingestFd(int fd) {
+    impl->clearAll();
+    appendFd(fd);
+}
+
+void TripAnalyzer::appendFd(int fd) {
+    auto scope = impl->beginWrite();
+    if (fd < 0) return;
+    ingestUnmapped(impl.get(), fd);
+}
+
+void TripAnalyzer::ingestBuffer(const char* data, size_t len) {
+    auto scope = impl->beginWrite();
+    BufferStream& bs = impl->stream;
+    const char* p = data;
+    const char* end = data + len;
+
+    if (!bs.headerDone) {
+        const char* nl = (const char*)std::memchr(p, '\n', len);
+        if (!nl) {
+            bs.pending.append(p, end);
+            return;
+        }
+        bs.pending.append(p, nl);
+        bs.schema = schemaFromHeader(bs.pending.data(), bs.pending.size());
+        bs.pending.clear();
+        bs.headerDone = true;
+        p = nl + 1;
+    }
+
+    // complete the row split over the previous chunk boundary
+    if (!bs.pending.empty()) {
+        const char* nl = (const char*)std::memchr(p, '\n', (size_t)(end - p));
+        if (!nl) {
+            bs.pending.append(p, end);
+            return;
+        }
+        bs.pending.append(p, nl + 1);
+        ingestLines(impl->data, impl->opts, impl->tripIds(), bs.schema, bs.pending.data(),
+                    bs.pending.data() + bs.pending.size(), false);
+        bs.pending.clear();
+        p = nl + 1;
+    }
+
+    const char* tail = ingestBody(impl.get(), bs.schema, p, end, false);
+    bs.pending.assign(tail, end);
+}
+
+void TripAnalyzer::finishBuffer() {
+    auto scope = impl->beginWrite();
+    BufferStream& bs = impl->stream;
+    if (bs.headerDone && !bs.pending.empty())
+        ingestLines(impl->data, impl->opts, impl->tripIds(), bs.schema, bs.pending.data(),
+                    bs.pending.data() + bs.pending.size(), true);
+    bs = BufferStream{};
+}
+
+// Buffered, checksummed write() sink for saveSnapshot.
+class SnapshotWriter {
+public:
+    explicit SnapshotWriter(int fd) : fd_(fd) { buf_.reserve(kBufSize); }
+
+    void put(const void* p, size_t n) {
+        const char* c = (const char*)p;
+        sum_.update(c, n);
+        written_ += n;
+        while (n) {
+            size_t room = kBufSize - buf_.size();
+            size_t take = std::min(room, n);
+            buf_.insert(buf_.end(), c, c + take);
+            c += take;
+            n -= take;
+            if (buf_.size() == kBufSize) flush();
+        }
+    }
+
+    void pad8() {
+        static const char zeros[8] = {};
+        put(zeros, (size_t)(align8(written_) - written_));
+    }
+
+    bool flush() {
+        size_t off = 0;
+        while (ok_ && off < buf_.size()) {
+            ssize_t n = ::write(fd_, buf_.data() + off, buf_.size() - off);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) ok_ = false;
+            else off += (size_t)n;
+        }
+        buf_.clear();
+        return ok_;
+    }
+
+    uint64_t written() const noexcept { return written_; }
+    uint64_t checksum() const noexcept { return sum_.value(); }
+
+private:
+    static constexpr size_t kBufSize = 1 << 20;
+
+    int fd_;
+    std::vector<char> buf_;
+    Checksum sum_;
+    uint64_t written_ = 0;
+    bool ok_ = true;
+};
+
+// Writes src (Aggregates or SnapshotView) to path via a temp file + rename.
+template <class Src>
+static bool writeSnapshot(const Src& src, const std::string& path) {
+    std::string tmp = path + ".tmp";
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) return false;
+
+    size_t n = src.zoneCount();
+    uint64_t namesBytes = 0;
+    for (size_t i = 0; i < n; ++i) namesBytes += src.zone(i).size();
+
+    SnapshotHeader h = {};
+    std::memcpy(h.magic, kSnapshotMagic, sizeof(h.magic));
+    h.version = kSnapshotVersion;
+    h.byteOrder = kByteOrderMark;
+    h.zoneCount = n;
+    h.namesBytes = namesBytes;
+    h.namesOff = sizeof(SnapshotHeader);
+    h.nameEndOff = align8(h.namesOff + namesBytes);
+    h.totalsOff = h.nameEndOff + n * 8;
+    h.hoursOff = h.totalsOff + n * 8;
+    h.fileSize = h.hoursOff + n * 24 * 8;
+
+    // payload first; the header goes in last, once the checksum is known
+    bool ok = ::lseek(fd, (off_t)h.namesOff, SEEK_SET) == (off_t)h.namesOff;
+
+    SnapshotWriter out(fd);
+    if (ok) {
+        for (size_t i = 0; i < n; ++i) {
+            std::string_view z = src.zone(i);
+            out.put(z.data(), z.size());
+        }
+        out.pad8();
+
+        uint64_t end = 0;
+        for (size_t i = 0; i < n; ++i) {
+            end += src.zone(i).size();
+            out.put(&end, 8);
+        }
+        for (size_t i = 0; i < n; ++i) {
+            int64_t c = src.total(i);
+            out.put(&c, 8);
+        }
+        for (size_t i = 0; i < n; ++i) {
+            int64_t row[24];
+            for (int hr = 0; hr < 24; ++hr) row[hr] = src.hour(i, hr);
+            out.put(row, sizeof(row));
+        }
+        ok = out.flush();
+    }
+
+    if (ok) {
+        h.checksum = out.checksum();
+        ok = ::pwrite(fd, &h, sizeof(h), 0) == (ssize_t)sizeof(h);
+    }
+
+    ok = (::close(fd) == 0) && ok;
+    if (ok) ok = ::rename(tmp.c_str(), path.c_str()) == 0;
+    if (!ok) ::unlink(tmp.c_str());
+    return ok;
+}
+
+bool TripAnalyzer::saveSnapshot(const std::string& path) const {
+    return impl->withSource([&](const auto& src) { return writeSnapshot(src, path); });
+}
+
+bool TripAnalyzer::loadSnapshot(const std::string& path) {
+    auto snap = std::make_unique<SnapshotView>();
+    if (!snap->open(path)) return false;
+
+    impl->clearAll();
+    if (impl->concurrent) {
+        // readers only see sides[], so the view is copied in like an ingest
+        auto scope = impl->beginWrite();
+        impl->loadView(*snap);
+    } else {
+        impl->snapshot = std::move(snap);
+    }
+    return true;
+}
+
+// ---------------- merging partial states ----------------
+
+static void addFrom(Aggregates& dst, const Aggregates& src) { dst.mergeFrom(src); }
+
+static void addFrom(Aggregates& dst, const SnapshotView& src) {
+    for (size_t i = 0; i < src.zoneCount(); ++i) {
+        int idx = dst.zoneSlot(src.zone(i));
+        for (int h = 0; h < 24; ++h) dst.add(idx, h, src.hour(i, h));
+    }
+}
+
+void TripAnalyzer::merge(const TripAnalyzer& other) {
+    if (&other == this) {
+        // the source must not change under the merge
+        Aggregates copy;
+        impl->withSource([&](const auto& src) { addFrom(copy, src); });
+        auto scope = impl->beginWrite();
+        impl->data.mergeFrom(copy);
+        return;
+    }
+    auto scope = impl->beginWrite();
+    other.impl->withSource([&](const auto& src) { addFrom(impl->data, src); });
+}
+
+// Wire format for partial states, all integers LEB128 varints:
+//   "TRIPPART" version zoneCount
+//   per zone: nameLen name hourMask (bit h = hour h non-empty) count...
+//   8-byte little-endian Checksum of everything before it
+// Zones with no pickups are left out. Totals are the sums of the hours.
+static constexpr char kWireMagic[8] = {'T', 'R', 'I', 'P', 'P', 'A', 'R', 'T'};
+static constexpr uint64_t kWireVersion = 1;
+
+static void putVarint(std::string& out, uint64_t v) {
+    while (v >= 0x80) {
+        out.push_back((char)(v | 0x80));
+        v >>= 7;
+    }
+    out.push_back((char)v);
+}
+
+class WireReader {
+public:
+    WireReader(const char* p, size_t n) : p_(p), end_(p + n) {}
+
+    bool varint(uint64_t& v) noexcept {
+        v = 0;
+        for (unsigned shift = 0; shift < 64; shift += 7) {
+            if (p_ == end_) return false;
+            unsigned char c = (unsigned char)*p_++;
+            v |= (uint64_t)(c & 0x7f) << shift;
+            if (!(c & 0x80)) return true;
+        }
+        return false;
+    }
+
+    bool bytes(uint64_t n, std::string_view& out) noexcept {
+        if (n > (uint64_t)(end_ - p_)) return false;
+        out = std::string_view(p_, (size_t)n);
+        p_ += n;
+        return true;
+    }
+
+    size_t left() const noexcept { return (size_t)(end_ - p_); }
+
+private:
+    const char* p_;
+    const char* end_;
+};
+
+template <class Src>
+static std::string encodePartial(const Src& src) {
+    std::string out(kWireMagic, sizeof(kWireMagic));
+    putVarint(out, kWireVersion);
+
+    size_t n = src.zoneCount(), live = 0;
+    for (size_t i = 0; i < n; ++i) live += src.total(i) != 0;
+    putVarint(out, live);
+
+    long long hours[24];
+    for (size_t i = 0; i < n; ++i) {
+        if (src.total(i) == 0) continue;
+        std::string_view name = src.zone(i);
+        putVarint(out, name.size());
+        out.append(name.data(), name.size());
+
+        uint32_t mask = 0;
+        for (int h = 0; h < 24; ++h) {
+            hours[h] = src.hour(i, h);
+            if (hours[h]) mask |= 1u << h;
+        }
+        putVarint(out, mask);
+        for (int h = 0; h < 24; ++h)
+            if (hours[h]) putVarint(out, (uint64_t)hours[h]);
+    }
+
+    Checksum sum;
+    sum.update(out.data(), out.size());
+    uint64_t c = sum.value();
+    for (int b = 0; b < 8; ++b) out.push_back((char)(c >> (8 * b)));
+    return out;
+}
+
+static bool decodePartial(const char* p, size_t n, Aggregates& out) {
+    if (n < sizeof(kWireMagic) + 8 || std::memcmp(p, kWireMagic, sizeof(kWireMagic)) != 0) return false;
+
+    size_t body = n - 8;
+    Checksum sum;
+    sum.update(p, body);
+    uint64_t want = 0;
+    for (int b = 0; b < 8; ++b) want |= (uint64_t)(unsigned char)p[body + b] << (8 * b);
+    if (sum.value() != want) return false;
+
+    WireReader r(p + sizeof(kWireMagic), body - sizeof(kWireMagic));
+    uint64_t version, zones;
+    if (!r.varint(version) || version != kWireVersion || !r.varint(zones)) return false;
+    if (zones > r.left()) return false;    // every zone takes at least three bytes
+
+    for (uint64_t z = 0; z < zones; ++z) {
+        uint64_t len, mask;
+        std::string_view name;
+        if (!r.varint(len) || len == 0 || !r.bytes(len, name)) return false;
+        if (!r.varint(mask) || mask == 0 || mask >> 24) return false;
+
+        int idx = out.zoneSlot(name);
+        for (int h = 0; h < 24; ++h) {
+            if (!(mask >> h & 1)) continue;
+            uint64_t c;
+            if (!r.varint(c) || c == 0 || c > (uint64_t)std::numeric_limits<long long>::max()) return false;
+            out.add(idx, h, (long long)c);
+        }
+    }
+    return r.left() == 0;
+}
+
+std::string TripAnalyzer::serializePartial() const {
+    return impl->withSource([&](const auto& src) { return encodePartial(src); });
+}
+
+bool TripAnalyzer::mergeSerialized(const char* data, size_t len) {
+    // decode aside first so a bad payload leaves the state unchanged
+    Aggregates part;
+    if (!data || !decodePartial(data, len, part)) return false;
+
+    auto scope = impl->beginWrite();
+    impl->data.mergeFrom(part);
+    return true;
+}
+
+
+
+// ---------------- top-k selection ----------------
+// Candidates are compact (count, zone index[, hour]) tuples; zone strings are
+// only read to break count ties and to build the k results.
+
+struct ZoneRank {
+    long long count;
+    uint32_t zone;
+};
+
+struct SlotRank {
+    long long count;
+    uint32_t zone;
+    int hour;
+};
+
+struct RouteRank {
+    long long count;
+    uint32_t pickup;
+    uint32_t dropoff;
+};
+
+// Small k against many candidates keeps a bounded heap; otherwise all
+// candidates are collected and ordered.
+static bool deepSelect(size_t k, size_t hint) noexcept { return k * 8 >= hint; }
+
+static constexpr size_t kRadixMin = 1 << 14;
+
+// Sorts v ascending by key(x, out) -> bool, with 16-bit LSD passes (passes
+// whose digit never varies are skipped). Returns false, leaving v alone, if
+// some element has no key.
+template <class T, class Key>
+static bool radixSort(std::vector<T>& v, Key key) {
+    std::vector<std::pair<uint64_t, uint32_t>> a(v.size()), b(v.size());
+    uint64_t all = 0, any = ~0ull;
+    for (size_t i = 0; i < v.size(); ++i) {
+        if (!key(v[i], a[i].first)) return false;
+        a[i].second = (uint32_t)i;
+        all |= a[i].first;
+        any &= a[i].first;
+    }
+
+    std::vector<size_t> count(1 << 16);
+    for (unsigned shift = 0; shift < 64; shift += 16) {
+        if ((((all ^ any) >> shift) & 0xffff) == 0) continue;   // same digit everywhere
+        std::fill(count.begin(), count.end(), 0);
+        for (const auto& e : a) ++count[(e.first >> shift) & 0xffff];
+        size_t sum = 0;
+        for (size_t& c : count) {
+            size_t t = c;
+            c = sum;
+            sum += t;
+        }
+        for (const auto& e : a) b[count[(e.first >> shift) & 0xffff]++] = e;
+        a.swap(b);
+    }
+
+    std::vector<T> sorted;
+    sorted.reserve(v.size());
+    for (const auto& e : a) sorted.push_back(v[e.second]);
+    v.swap(sorted);
+    return true;
+}
+
+// Orders v best first and keeps its best k.
+template <class T, class Better, class Key>
+static void orderRun(std::vector<T>& v, size_t k, Better better, Key key) {
+    if (v.size() >= kRadixMin && radixSort(v, key)) {
+        if (v.size() > k) v.resize(k);
+        return;
+    }
+    if (v.size() > k) {
+        std::nth_element(v.begin(), v.begin() + (std::ptrdiff_t)k, v.end(), better);
+        v.resize(k);
+    }
+    std::sort(v.begin(), v.end(), better);
+}
+
+// The best k of several best-first runs, best first, as emit(x).
+template <class T, class Better, class Emit>
+static void mergeRuns(const std::vector<std::vector<T>>& runs, size_t k, Better better, Emit emit) {
+    // (run, position) heads; the heap front is the best of them
+    std::vector<std::pair<size_t, size_t>> heads;
+    for (size_t i = 0; i < runs.size(); ++i)
+        if (!runs[i].empty()) heads.push_back({i, 0});
+    auto worse = [&](const std::pair<size_t, size_t>& a, const std::pair<size_t, size_t>& b) {
+        return better(runs[b.first][b.second], runs[a.first][a.second]);
+    };
+    std::make_heap(heads.begin(), heads.end(), worse);
+    for (size_t done = 0; !heads.empty() && done < k; ++done) {
+        std::pop_heap(heads.begin(), heads.end(), worse);
+        auto& h = heads.back();
+        emit(runs[h.first][h.second]);
+        if (++h.second < runs[h.first].size()) std::push_heap(heads.begin(), heads.end(), worse);
+        else heads.pop_back();
+    }
+}
+
+// Best `k` of the candidates produced by gen(push), best first. Small k keeps a
+// bounded heap whose front is the worst survivor; large k selects in place, or
+// radix-sorts everything when `key` gives a 64-bit key in `better` order.
+template <class T, class Better, class Gen, class Key>
+static std::vector<T> selectTop(size_t k, size_t hint, Better better, Gen gen, Key key) {
+    std::vector<T> out;
+    if (k == 0) return out;
+
+    if (!deepSelect(k, hint)) {
+        out.reserve(k);
+        gen([&](const T& c) {
+            if (out.size() < k) {
+                out.push_back(c);
+                std::push_heap(out.begin(), out.end(), better);
+            } else if (better(c, out.front())) {
+                std::pop_heap(out.begin(), out.end(), better);
+                out.back() = c;
+                std::push_heap(out.begin(), out.end(), better);
+            }
+        });
+        std::sort_heap(out.begin(), out.end(), better);
+        return out;
+    }
+
+    out.reserve(hint);
+    gen([&](const T& c) { out.push_back(c); });
+    orderRun(out, k, better, key);
+    return out;
+}
+
+template <class T, class Better, class Gen>
+static std::vector<T> selectTop(size_t k, size_t hint, Better better, Gen gen) {
+    return selectTop<T>(k, hint, better, gen, [](const T&, uint64_t&) { return false; });
+}
+
+static constexpr size_t kParallelRankMin = 1 << 17;
+static constexpr size_t kMinCandidatesPerWorker = 1 << 15;
+
+// Threads for a ranking of `candidates`: only deep selections over many
+// candidates are split, since shallow ones are a single cheap heap pass.
+static unsigned rankWorkers(const AnalyzerOptions& opts, size_t k, size_t candidates) {
+    if (!deepSelect(k, candidates) || candidates < kParallelRankMin) return 1;
+    return poolSize(opts, candidates, kMinCandidatesPerWorker);
+}
+
+// selectTop over candidates generated by index range, handing the winners to
+// emit(x) best first: gen(lo, hi, push) covers indices [lo, hi) of n. With
+// several workers, each orders the candidates of its own slice of [0, n) and
+// the runs are merged as they are emitted; the order is the same as the
+// serial one because `better` is a total order.
+template <class T, class Better, class Gen, class Key, class Emit>
+static void visitTopParts(size_t k, size_t n, size_t hint, unsigned workers, Better better, Gen gen, Key key,
+                          Emit emit) {
+    if (workers <= 1 || k == 0 || !deepSelect(k, hint)) {
+        auto all = [&](auto&& push) { gen(0, n, push); };
+        for (const T& x : selectTop<T>(k, hint, better, all, key)) emit(x);
+        return;
+    }
+
+    std::vector<std::vector<T>> runs(workers);
+    runParts(workers, [&](size_t i) {
+        std::vector<T>& run = runs[i];
+        run.reserve(hint / workers);
+        gen(n * i / workers, n * (i + 1) / workers, [&](const T& c) { run.push_back(c); });
+        orderRun(run, k, better, key);
+    });
+    mergeRuns(runs, k, better, emit);
+}
+
+// make(top[i]) for every i, split over `workers`; this is where names get copied
+template <class R, class T, class Make>
+static std::vector<R> buildParts(const std::vector<T>& top, unsigned workers, Make make) {
+    std::vector<R> out(top.size());
+    runParts(workers, [&](size_t i) {
+        for (size_t j = top.size() * i / workers, end = top.size() * (i + 1) / workers; j < end; ++j)
+            out[j] = make(top[j]);
+    });
+    return out;
+}
+
+// Zone tie-break: integer compares on the lexicographic ranks when they are
+// current or worth building (deep selections), else the names themselves.
+template <class Src>
+struct ZoneOrder {
+    const Src& src;
+    const uint32_t* rank;
+
+    bool operator()(uint32_t a, uint32_t b) const {
+        return rank ? rank[a] < rank[b] : src.zone(a) < src.zone(b);
+    }
+};
+
+template <class Src>
+static ZoneOrder<Src> zoneOrder(const Src& src, size_t k, size_t hint, unsigned workers) {
+    const uint32_t* rank = deepSelect(k, hint) ? src.lexRanks(workers).data() : src.readyLexRanks();
+    return ZoneOrder<Src>{src, rank};
+}
+
+// count desc, then `low` asc, as one radix key; counts must fit 32 bits
+static inline bool countKey(long long count, uint64_t low, uint64_t& key) noexcept {
+    if ((unsigned long long)count > 0xffffffffull || low > 0xffffffffull) return false;
+    key = (0xffffffffull - (uint64_t)count) << 32 | low;
+    return true;
+}
+
+// The best k zones of src as emit(ZoneRank), best first
+template <class Src, class Emit>
+static void forTopZones(const Src& src, int k, const AnalyzerOptions& opts, Emit emit) {
+    size_t n = src.zoneCount();
+    unsigned workers = rankWorkers(opts, (size_t)k, n);
+    ZoneOrder<Src> order = zoneOrder(src, (size_t)k, n, workers);
+
+    // count desc, zone asc
+    auto better = [&](const ZoneRank& a, const ZoneRank& b) {
+        if (a.count != b.count) return a.count > b.count;
+        return order(a.zone, b.zone);
+    };
+    auto key = [&](const ZoneRank& r, uint64_t& out) { return order.rank && countKey(r.count, order.rank[r.zone], out); };
+
+    visitTopParts<ZoneRank>((size_t)k, n, n, workers, better, [&](size_t lo, size_t hi, auto&& push) {
+        for (size_t i = lo; i < hi; ++i) {
+            if (long long c = src.total(i)) push(ZoneRank{c, (uint32_t)i});
+        }
+    }, key, emit);
+}
+
+template <class Src>
+static std::vector<ZoneCount> rankZones(const Src& src, int k, const AnalyzerOptions& opts) {
+    std::vector<ZoneRank> top;
+    forTopZones(src, k, opts, [&](const ZoneRank& r) { top.push_back(r); });
+    return buildParts<ZoneCount>(top, rankWorkers(opts, (size_t)k, src.zoneCount()), [&](const ZoneRank& r) {
+        return ZoneCount{std::string(src.zone(r.zone)), r.count};
+    });
+}
+
+// The best k slots of src as emit(SlotRank), best first
+template <class Src, class Emit>
+static void forTopSlots(const Src& src, int k, const AnalyzerOptions& opts, Emit emit) {
+    size_t n = src.zoneCount();
+    unsigned workers = rankWorkers(opts, (size_t)k, n * 4);
+    ZoneOrder<Src> order = zoneOrder(src, (size_t)k, n * 4, workers);
+
+    // count desc, zone asc, hour asc
+    auto better = [&](const SlotRank& a, const SlotRank& b) {
+        if (a.count != b.count) return a.count > b.count;
+        if (a.zone != b.zone) return order(a.zone, b.zone);
+        return a.hour < b.hour;
+    };
+    auto key = [&](const SlotRank& r, uint64_t& out) {
+        return order.rank && countKey(r.count, (uint64_t)order.rank[r.zone] * 24 + (uint64_t)r.hour, out);
+    };
+
+    visitTopParts<SlotRank>((size_t)k, n, n * 4, workers, better, [&](size_t lo, size_t hi, auto&& push) {
+        for (size_t i = lo; i < hi; ++i) {
+            for (int h = 0; h < 24; ++h) {
+                long long c = src.hour(i, h);
+                if (c) push(SlotRank{c, (uint32_t)i, h});
+            }
+        }
+    }, key, emit);
+}
+
+template <class Src>
+static std::vector<SlotCount> rankSlots(const Src& src, int k, const AnalyzerOptions& opts) {
+    std::vector<SlotRank> top;
+    forTopSlots(src, k, opts, [&](const SlotRank& r) { top.push_back(r); });
+    return buildParts<SlotCount>(top, rankWorkers(opts, (size_t)k, src.zoneCount() * 4), [&](const SlotRank& r) {
+        return SlotCount{std::string(src.zone(r.zone)), r.hour, r.count};
+    });
+}
+
+template <class T>
+static std::vector<T> prefix(const std::vector<T>& v, int k) {
+    size_t n = k > 0 ? std::min(v.size(), (size_t)k) : 0;
+    return std::vector<T>(v.begin(), v.begin() + (std::ptrdiff_t)n);
+}
+
+// The best `k` of src (published as `version`): from the cached ranking when
+// it is still current and deep enough, otherwise recomputed for `k` and kept.
+template <class T, class Src, class Rank>
+static std::vector<T> cachedRank(TripAnalyzerImpl& impl, CachedRanking<T>& cache, const Src& src,
+                                 uint64_t version, int k, Rank rank) {
+    if (k <= 0) return {};
+    if (!impl.opts.rankingCache) return rank(src, k, impl.opts);
+
+    std::lock_guard<std::mutex> lock(impl.rankingMu);
+    if (cache.version != version || (!cache.complete && (size_t)k > cache.items.size())) {
+        cache.items = rank(src, k, impl.opts);
+        cache.complete = cache.items.size() < (size_t)k;
+        cache.version = version;
+    }
+    return prefix(cache.items, k);
+}
+
+template <class T, class Rank>
+static std::vector<T> cachedTop(TripAnalyzerImpl& impl, CachedRanking<T>& cache, int k, Rank rank) {
+    if (k <= 0) return {};
+    return impl.read([&](const auto& src, uint64_t version) {
+        return cachedRank(impl, cache, src, version, k, rank);
+    });
+}
+
+// Approximate-mode rankings, same order as the exact ones
+static std::vector<ZoneCount> rankApproxZones(const SpaceSaving& sketch, int k) {
+    auto better = [](const SpaceSaving::Counter* a, const SpaceSaving::Counter* b) {
+        if (a->count != b->count) return a->count > b->count;
+        return a->zone < b->zone;
+    };
+    const auto& all = sketch.counters();
+    auto top = selectTop<const SpaceSaving::Counter*>((size_t)k, all.size(), better, [&](auto&& push) {
+        for (const auto& c : all) push(&c);
+    });
+
+    std::vector<ZoneCount> result;
+    result.reserve(top.size());
+    for (const auto* c : top) result.push_back({c->zone, c->count});
+    return result;
+}
+
+static std::vector<SlotCount> rankApproxSlots(const SpaceSaving& sketch, int k) {
+    auto better = [](const SpaceSaving::Counter* a, const SpaceSaving::Counter* b) {
+        if (a->count != b->count) return a->count > b->count;
+        if (a->zone != b->zone) return a->zone < b->zone;
+        return a->hour < b->hour;
+    };
+    const auto& all = sketch.counters();
+    auto top = selectTop<const SpaceSaving::Counter*>((size_t)k, all.size(), better, [&](auto&& push) {
+        for (const auto& c : all) push(&c);
+    });
+
+    std::vector<SlotCount> result;
+    result.reserve(top.size());
+    for (const auto* c : top) result.push_back({c->zone, c->hour, c->count});
+    return result;
+}
+
+static const HeavyHitters* heavyOf(const Aggregates& agg) noexcept { return agg.heavy.get(); }
+static const HeavyHitters* heavyOf(const SnapshotView&) noexcept { return nullptr; }
+
+static const auto kRankZones = [](const auto& src, int n, const AnalyzerOptions& opts) {
+    if (const HeavyHitters* hh = heavyOf(src)) return rankApproxZones(hh->zones, n);
+    return rankZones(src, n, opts);
+};
+static const auto kRankSlots = [](const auto& src, int n, const AnalyzerOptions& opts) {
+    if (const HeavyHitters* hh = heavyOf(src)) return rankApproxSlots(hh->slots, n);
+    return rankSlots(src, n, opts);
+};
+
+std::vector<ZoneCount> TripAnalyzer::topZones(int k) const {
+    return cachedTop(*impl, impl->zoneRanking, k, kRankZones);
+}
+
+std::vector<SlotCount> TripAnalyzer::topBusySlots(int k) const {
+    return cachedTop(*impl, impl->slotRanking, k, kRankSlots);
+}
+
+void TripAnalyzer::visitTopZones(int k, const ZoneVisitor& visit) const {
+    if (k <= 0) return;
+    impl->withSource([&](const auto& src) {
+        if (const HeavyHitters* hh = heavyOf(src)) {
+            for (const ZoneCount& z : rankApproxZones(hh->zones, k)) visit(z.zone, z.count);
+            return;
+        }
+        forTopZones(src, k, impl->opts, [&](const ZoneRank& r) { visit(src.zone(r.zone), r.count); });
+    });
+}
+
+void TripAnalyzer::visitTopBusySlots(int k, const SlotVisitor& visit) const {
+    if (k <= 0) return;
+    impl->withSource([&](const auto& src) {
+        if (const HeavyHitters* hh = heavyOf(src)) {
+            for (const SlotCount& z : rankApproxSlots(hh->slots, k)) visit(z.zone, z.hour, z.count);
+            return;
+        }
+        forTopSlots(src, k, impl->opts, [&](const SlotRank& r) { visit(src.zone(r.zone), r.hour, r.count); });
+    });
+}
+
+TopKReport TripAnalyzer::topMany(const std::vector<int>& zoneKs, const std::vector<int>& slotKs) const {
+    int zoneMax = 0, slotMax = 0;
+    for (int k : zoneKs) zoneMax = std::max(zoneMax, k);
+    for (int k : slotKs) slotMax = std::max(slotMax, k);
+
+    // one selection per ranking at the deepest k, on one published state
+    return impl->read([&](const auto& src, uint64_t version) {
+        std::vector<ZoneCount> zones = cachedRank(*impl, impl->zoneRanking, src, version, zoneMax, kRankZones);
+        std::vector<SlotCount> slots = cachedRank(*impl, impl->slotRanking, src, version, slotMax, kRankSlots);
+
+        TopKReport report;
+        report.zones.reserve(zoneKs.size());
+        report.slots.reserve(slotKs.size());
+        for (int k : zoneKs) report.zones.push_back(prefix(zones, k));
+        for (int k : slotKs) report.slots.push_back(prefix(slots, k));
+        return report;
+    });
+}
+
+// Dropoff tallies in the rankZones source shape
+struct DropoffSource {
+    const Aggregates& agg;
+    size_t zoneCount() const noexcept { return agg.zoneCount(); }
+    std::string_view zone(size_t i) const noexcept { return agg.zone(i); }
+    long long total(size_t i) const noexcept { return agg.dropoffs(i); }
+    const std::vector<uint32_t>& lexRanks(unsigned workers) const { return agg.lexRanks(workers); }
+    const uint32_t* readyLexRanks() const noexcept { return agg.readyLexRanks(); }
+};
+
+std::vector<ZoneCount> TripAnalyzer::topDropoffZones(int k) const {
+    if (k <= 0) return {};
+    return impl->withData([&](const Aggregates& agg) { return rankZones(DropoffSource{agg}, k, impl->opts); });
+}
+
+std::vector<RouteCount> TripAnalyzer::topRoutes(int k) const {
+    if (k <= 0) return {};
+    return impl->withData([&](const Aggregates& agg) {
+        size_t n = agg.routes.size();
+        ZoneOrder<Aggregates> order = zoneOrder(agg, (size_t)k, n, rankWorkers(impl->opts, (size_t)k, n));
+
+        // count desc, pickup asc, dropoff asc
+        auto better = [&](const RouteRank& a, const RouteRank& b) {
+            if (a.count != b.count) return a.count > b.count;
+            if (a.pickup != b.pickup) return order(a.pickup, b.pickup);
+            return order(a.dropoff, b.dropoff);
+        };
+
+        auto top = selectTop<RouteRank>((size_t)k, agg.routes.size(), better, [&](auto&& push) {
+            agg.routes.forEach([&](uint64_t key, long long n) {
+                push(RouteRank{n, (uint32_t)(key >> 32), (uint32_t)key});
+            });
+        });
+
+        std::vector<RouteCount> result;
+        result.reserve(top.size());
+        for (const RouteRank& r : top)
+            result.push_back({std::string(agg.zone(r.pickup)), std::string(agg.zone(r.dropoff)), r.count});
+        return result;
+    });
+}
+
+// TimeFilter over bucket numbers
+struct BucketFilter {
+    int dayLo, dayHi;
+    unsigned weekdays;
+    int quarterLo, quarterHi;
+
+    explicit BucketFilter(const TimeFilter& f)
+        : dayLo(f.fromDate ? dayOf(f.fromDate) : std::numeric_limits<int>::min()),
+          dayHi(f.toDate ? dayOf(f.toDate) : std::numeric_limits<int>::max()),
+          weekdays(f.weekdays),
+          quarterLo((f.fromMinute + 14) / 15),
+          quarterHi((f.toMinute + 14) / 15) {}
+
+    bool accepts(uint32_t bucket) const noexcept {
+        int day = (int)(bucket / Aggregates::kQuarters) - Aggregates::kDayBias;
+        int quarter = (int)(bucket % Aggregates::kQuarters);
+        int weekday = ((day % 7) + 10) % 7;    // 1970-01-01 was a Thursday; Monday = 0
+        return day >= dayLo && day <= dayHi && quarter >= quarterLo && quarter < quarterHi &&
+               (weekdays >> weekday & 1u);
+    }
+
+    static int dayOf(int yyyymmdd) noexcept {
+        return daysFromCivil(yyyymmdd / 10000, yyyymmdd / 100 % 100, yyyymmdd % 100);
+    }
+};
+
+// Filtered per-zone totals in the rankZones source shape
+struct FilteredZones {
+    const Aggregates& agg;
+    std::vector<long long> counts;
+    size_t zoneCount() const noexcept { return agg.zoneCount(); }
+    std::string_view zone(size_t i) const noexcept { return agg.zone(i); }
+    long long total(size_t i) const noexcept { return counts[i]; }
+    const std::vector<uint32_t>& lexRanks(unsigned workers) const { return agg.lexRanks(workers); }
+    const uint32_t* readyLexRanks() const noexcept { return agg.readyLexRanks(); }
+};
+
+std::vector<ZoneCount> TripAnalyzer::topZones(int k, const TimeFilter& filter) const {
+    if (k <= 0) return {};
+    return impl->withData([&](const Aggregates& agg) {
+        BucketFilter bf(filter);
+
+        FilteredZones src{agg, std::vector<long long>(agg.zoneCount(), 0)};
+        agg.stamps.forEach([&](uint64_t key, long long n) {
+            if (bf.accepts((uint32_t)key)) src.counts[(size_t)(key >> 32)] += n;
+        });
+        return rankZones(src, k, impl->opts);
+    });
+}
+
+std::vector<SlotCount> TripAnalyzer::topBusySlots(int k, const TimeFilter& filter) const {
+    if (k <= 0) return {};
+    return impl->withData([&](const Aggregates& agg) {
+        BucketFilter bf(filter);
+
+        // sparse (zone, hour) totals
+        PairTable slots;
+        agg.stamps.forEach([&](uint64_t key, long long n) {
+            uint32_t bucket = (uint32_t)key;
+            if (!bf.accepts(bucket)) return;
+            uint32_t hour = bucket % Aggregates::kQuarters / 4;
+            slots.add(PairTable::key((uint32_t)(key >> 32), hour), n);
+        });
+
+        size_t n = slots.size();
+        ZoneOrder<Aggregates> order = zoneOrder(agg, (size_t)k, n, rankWorkers(impl->opts, (size_t)k, n));
+
+        // same order as rankSlots: count desc, zone asc, hour asc
+        auto better = [&](const SlotRank& a, const SlotRank& b) {
+            if (a.count != b.count) return a.count > b.count;
+            if (a.zone != b.zone) return order(a.zone, b.zone);
+            return a.hour < b.hour;
+        };
+        auto top = selectTop<SlotRank>((size_t)k, slots.size(), better, [&](auto&& push) {
+            slots.forEach([&](uint64_t key, long long n) {
+                push(SlotRank{n, (uint32_t)(key >> 32), (int)(uint32_t)key});
+            });
+        });
+
+        std::vector<SlotCount> result;
+        result.reserve(top.size());
+        for (const SlotRank& r : top) result.push_back({std::string(agg.zone(r.zone)), r.hour, r.count});
+        return result;
+    });
+}
+
+std::vector<SlotTotals> TripAnalyzer::slotTotals(const std::string& zone) const {
+    return impl->withData([&](const Aggregates& agg) {
+        std::vector<SlotTotals> result;
+        int idx = agg.findZone(zone);
+        if (idx < 0) return result;
+
+        for (int h = 0; h < 24; ++h) {
+            long long c = agg.hour((size_t)idx, h);
+            long long fare = agg.fare((size_t)idx, h);
+            long long dist = agg.distance((size_t)idx, h);
+            if (c == 0 && fare == 0 && dist == 0) continue;
+            result.push_back({zone, h, c, (double)fare / 1000.0, (double)dist / 1000.0});
+        }
+        return result;
+    });
+}
+
+IngestStats TripAnalyzer::ingestStats() const {
+    return impl->withData([&](const Aggregates& agg) {
+        const RowStats& st = agg.stats;
+        IngestStats out;
+        out.rowsRead = st.rows;
+        out.missingFields = st.missingFields;
+        out.emptyZone = st.emptyZone;
+        out.badDatetime = st.badDatetime;
+        out.badHour = st.badHour;
+        out.duplicateTrips = st.duplicateIds;
+        out.rowsAccepted = st.rows - st.missingFields - st.emptyZone - st.badDatetime - st.badHour - st.duplicateIds;
+        out.bytes = st.bytes;
+        out.uniqueZones = agg.zoneCount();
+        size_t cap = agg.zoneIndex.capacity();
+        out.loadFactor = cap ? (double)agg.zoneIndex.size() / (double)cap : 0.0;
+        out.meanProbeLength = agg.zoneIndex.meanProbeLength();
+        out.ioMs = (double)st.ioNs / 1e6;
+        out.parseMs = (double)st.parseNs / 1e6;
+        out.aggregateMs = (double)st.aggregateNs / 1e6;
+        return out;
+    });
+}
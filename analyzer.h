@@ -1,5 +1,10 @@
 #pragma once
+#include <cstddef>
+#include <functional>
+#include <iosfwd>
+#include <memory>
 #include <string>
+#include <string_view>
 #include <vector>
 
 struct ZoneCount {
@@ -13,14 +18,193 @@ struct SlotCount {
     long long count;
 };
 
+// visitTopZones / visitTopBusySlots callbacks. The zone name is only valid
+// during the call.
+using ZoneVisitor = std::function<void(std::string_view zone, long long count)>;
+using SlotVisitor = std::function<void(std::string_view zone, int hour, long long count)>;
+
+// topMany() answers, one list per requested k, in request order
+struct TopKReport {
+    std::vector<std::vector<ZoneCount>> zones;
+    std::vector<std::vector<SlotCount>> slots;
+};
+
+struct RouteCount {
+    std::string pickup;
+    std::string dropoff;
+    long long count;
+};
+
+// Per pickup zone and hour. revenue and distanceKm sum only the rows where
+// that field parsed.
+struct SlotTotals {
+    std::string zone;
+    int hour;              // 0–23
+    long long count;
+    double revenue;
+    double distanceKm;
+};
+
+// Restricts the time-bucketed queries. Dates are YYYYMMDD and inclusive, 0
+// leaves that side open. Minutes of day are [fromMinute, toMinute), rounded
+// to the 15-minute buckets.
+struct TimeFilter {
+    int fromDate = 0;
+    int toDate = 0;
+    unsigned weekdays = 0x7f;   // bit 0 = Monday ... bit 6 = Sunday
+    int fromMinute = 0;
+    int toMinute = 24 * 60;
+};
+
+// Totals since the last replacing ingest (ingestFile etc.). Timings are summed
+// over worker threads. Row counters and timings read zero in builds with
+// TRIP_INGEST_STATS=0, and snapshots carry none of this.
+struct IngestStats {
+    unsigned long long rowsRead = 0;        // non-empty lines after the header
+    unsigned long long rowsAccepted = 0;
+    unsigned long long missingFields = 0;   // too few fields for the six columns
+    unsigned long long emptyZone = 0;
+    unsigned long long badDatetime = 0;     // empty, or not "YYYY-MM-DD HH..."
+    unsigned long long badHour = 0;         // hour digits outside 00-23
+    unsigned long long duplicateTrips = 0;  // valid rows skipped by AnalyzerOptions::dedupTripIds
+    unsigned long long bytes = 0;           // row bytes scanned
+    size_t uniqueZones = 0;
+    double loadFactor = 0;                  // zone hash table
+    double meanProbeLength = 0;             // slots per successful zone lookup
+    double ioMs = 0;                        // read() / mmap, or waiting on the decompressor
+    double parseMs = 0;                     // locating rows and fields
+    double aggregateMs = 0;                 // checking fields and counting
+};
+
+struct AnalyzerOptions {
+    unsigned threads = 0;                 // ingest workers, 0 = hardware_concurrency()
+    size_t parallelMinBytes = 8u << 20;   // smaller files are parsed on one thread
+    bool rankingCache = true;             // repeat top-k queries reuse the last ranking until the next ingest
+    bool extendedColumns = false;         // also aggregate DropoffZoneID, DistanceKm and FareAmount
+    bool timeBuckets = false;             // also count trips per date and 15-minute bucket (sparse)
+    bool concurrentReads = false;         // queries may run during ingest (see TripAnalyzer)
+
+    // Count each TripID once since the last replacing ingest, for replayed
+    // input: a valid row whose TripID was already counted is skipped. IDs
+    // compare as unsigned integers (up to 19 digits); rows with other TripIDs
+    // always count. Ingest is serial. The seen IDs are not kept in snapshots
+    // or serializePartial(), and merge() does not dedupe across analyzers.
+    bool dedupTripIds = false;
+
+    // > 0: approximate mode for unbounded zone sets. topZones / topBusySlots
+    // come from Space-Saving sketches with this many counters each, in fixed
+    // memory. A reported count overestimates the true one by at most
+    // N / approxCapacity after N counted trips. Every zone or slot with more
+    // than that many trips is reported. Ingest is serial, and the other
+    // queries, snapshots and serializePartial() see no data. Choose before the
+    // first ingest; a replacing ingest starts a new sketch.
+    size_t approxCapacity = 0;
+};
+
+class TripAnalyzerImpl;
+
+// Each analyzer owns its state; separate instances can be used from
+// different threads without locking. Not copyable; a moved-from analyzer may
+// only be assigned to or destroyed.
+//
+// With AnalyzerOptions::concurrentReads, one thread may ingest while others
+// query. Queries never wait for the ingest. They see the state as of the
+// last finished ingest call; streams and fds also publish every 32 MiB. The
+// aggregates are kept twice, and snapshots are loaded by copying. setOptions
+// must not race with anything.
 class TripAnalyzer {
 public:
-    // Parse Trips.csv, skip dirty rows, never crash
+    TripAnalyzer();
+    ~TripAnalyzer();
+    TripAnalyzer(TripAnalyzer&&) noexcept;
+    TripAnalyzer& operator=(TripAnalyzer&&) noexcept;
+
+    // Applies to subsequent ingest calls
+    void setOptions(const AnalyzerOptions& opts);
+
+    // Parse Trips.csv, skip dirty rows, never crash. The delimiter is ','
+    // unless the header only splits into six fields, or names all six
+    // columns, on ';', tab or '|' (and the first row is not ',' separated).
+    // A header naming all six columns (case, '_' and '-' ignored) also gives
+    // their order; otherwise the standard order applies. PickupDateTime is
+    // "YYYY-MM-DD HH:MM"; under a renamed header an ISO "YYYY-MM-DDTHH:MM"
+    // row counts too. Anything after the minutes is ignored. Fields cannot
+    // contain the delimiter, quoted or not.
     void ingestFile(const std::string& csvPath);
 
+    // Like ingestFile, but adds to what was ingested before
+    void appendFile(const std::string& csvPath);
+
+    // Like ingestFile / appendFile for pipes, sockets and stdin. The input is
+    // read to EOF through one fixed-size buffer, so memory does not grow with
+    // its length. The fd is not closed.
+    void ingestStream(std::istream& in);
+    void appendStream(std::istream& in);
+    void ingestFd(int fd);
+    void appendFd(int fd);
+
+    // Appends the next chunk of a CSV stream (header line first, as in a
+    // file). Chunks may end mid-row; finishBuffer() flushes the last row and
+    // ends the stream, so the next ingestBuffer() expects a new header.
+    void ingestBuffer(const char* data, size_t len);
+    void finishBuffer();
+
+    // Binary dump of the aggregated counts (versioned, checksummed). Returns
+    // false if the file could not be written.
+    bool saveSnapshot(const std::string& path) const;
+
+    // Replaces the current state with a saved snapshot. The file is mapped and
+    // validated, and queries read it in place. The first later ingest copies it
+    // into memory. Returns false, with the state unchanged, if the file is
+    // missing or invalid.
+    bool loadSnapshot(const std::string& path);
+
+    // Adds another analyzer's counts, as if its input had been ingested here
+    // too. Rankings after merging match a single analyzer fed all the input.
+    void merge(const TripAnalyzer& other);
+
+    // Compact, checksummed encoding of the zone/hour counts, for combining
+    // partial results across processes. mergeSerialized() adds one in and
+    // returns false, with the state unchanged, if the payload is malformed.
+    std::string serializePartial() const;
+    bool mergeSerialized(const char* data, size_t len);
+
     // Top K zones: count desc, zone asc
     std::vector<ZoneCount> topZones(int k = 10) const;
 
     // Top K slots: count desc, zone asc, hour asc
     std::vector<SlotCount> topBusySlots(int k = 10) const;
+
+    // topZones / topBusySlots without copying names: visit gets each entry in
+    // the same order. Deep rankings split over threads are visited while their
+    // per-thread runs are still being merged. The ranking cache is neither used
+    // nor filled, and visit must not modify this analyzer.
+    void visitTopZones(int k, const ZoneVisitor& visit) const;
+    void visitTopBusySlots(int k, const SlotVisitor& visit) const;
+
+    // topZones(k) for every k in zoneKs and topBusySlots(k) for every k in
+    // slotKs, from one selection per ranking at the largest k
+    TopKReport topMany(const std::vector<int>& zoneKs, const std::vector<int>& slotKs) const;
+
+    IngestStats ingestStats() const;
+
+    // The next three need AnalyzerOptions::extendedColumns during ingest; their
+    // totals are not kept in snapshots.
+    //
+    // Top K dropoff zones: count desc, zone asc
+    std::vector<ZoneCount> topDropoffZones(int k = 10) const;
+
+    // Top K (pickup, dropoff) pairs: count desc, pickup asc, dropoff asc
+    std::vector<RouteCount> topRoutes(int k = 10) const;
+
+    // Nonempty hours of one pickup zone, hour asc
+    std::vector<SlotTotals> slotTotals(const std::string& zone) const;
+
+    // topZones / topBusySlots over the trips inside `filter`. Need
+    // AnalyzerOptions::timeBuckets during ingest; not kept in snapshots.
+    std::vector<ZoneCount> topZones(int k, const TimeFilter& filter) const;
+    std::vector<SlotCount> topBusySlots(int k, const TimeFilter& filter) const;
+
+private:
+    std::unique_ptr<TripAnalyzerImpl> impl;
 };
@@ -0,0 +1,251 @@
+#include "analyzer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <sys/resource.h>
+
+// Synthetic-data benchmark: generates a trips CSV, then times ingest and the
+// two top-k queries separately.
+//
+//   ./benchmark --rows=2000000 --zones=100000 --zipf=1.1 --dirty=0.02 --quoted=0.1
+//
+// All options are --name=value; see usage() for the full list.
+
+struct BenchConfig {
+    long long rows = 1000000;
+    long long zones = 10000;
+    double zipf = 1.0;          // 0 = uniform
+    double dirty = 0.01;        // fraction of malformed rows
+    double quoted = 0.0;        // fraction of rows with "quoted" datetimes
+    unsigned long long seed = 42;
+    unsigned threads = 0;       // AnalyzerOptions::threads
+    int reps = 3;               // ingest repetitions (median reported)
+    int queries = 200;          // latency samples per query
+    int k = 10;
+    bool cache = false;         // measure with the ranking cache enabled
+    bool keep = false;          // keep the generated file
+    std::string path = "bench_trips.csv";
+};
+
+using Clock = std::chrono::steady_clock;
+
+static double msSince(Clock::time_point t0) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - t0).count();
+}
+
+static void usage() {
+    std::cerr << "usage: benchmark [--rows=N] [--zones=N] [--zipf=S] [--dirty=F] [--quoted=F]\n"
+                 "                 [--seed=N] [--threads=N] [--reps=N] [--queries=N] [--k=N]\n"
+                 "                 [--cache] [--keep] [--path=FILE]\n";
+}
+
+static bool parseArgs(int argc, char** argv, BenchConfig& cfg) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        std::string name = arg, value;
+        size_t eq = arg.find('=');
+        if (eq != std::string::npos) {
+            name = arg.substr(0, eq);
+            value = arg.substr(eq + 1);
+        }
+
+        if (name == "--rows") cfg.rows = std::atoll(value.c_str());
+        else if (name == "--zones") cfg.zones = std::max(1LL, std::atoll(value.c_str()));
+        else if (name == "--zipf") cfg.zipf = std::atof(value.c_str());
+        else if (name == "--dirty") cfg.dirty = std::atof(value.c_str());
+        else if (name == "--quoted") cfg.quoted = std::atof(value.c_str());
+        else if (name == "--seed") cfg.seed = std::strtoull(value.c_str(), nullptr, 10);
+        else if (name == "--threads") cfg.threads = (unsigned)std::atoi(value.c_str());
+        else if (name == "--reps") cfg.reps = std::max(1, std::atoi(value.c_str()));
+        else if (name == "--queries") cfg.queries = std::max(1, std::atoi(value.c_str()));
+        else if (name == "--k") cfg.k = std::atoi(value.c_str());
+        else if (name == "--cache") cfg.cache = true;
+        else if (name == "--keep") cfg.keep = true;
+        else if (name == "--path") cfg.path = value;
+        else {
+            usage();
+            return false;
+        }
+    }
+    return true;
+}
+
+// Draws zone IDs with Zipf(s) popularity. Names are shuffled across ranks so
+// the hot zones are not simply the lexicographically smallest ones.
+class ZoneSampler {
+public:
+    ZoneSampler(const BenchConfig& cfg, std::mt19937_64& rng) : rng_(rng), pick_(0.0, 1.0) {
+        size_t n = (size_t)cfg.zones;
+        cdf_.resize(n);
+        double sum = 0;
+        for (size_t r = 0; r < n; ++r) {
+            sum += 1.0 / std::pow((double)(r + 1), cfg.zipf);
+            cdf_[r] = sum;
+        }
+        for (double& c : cdf_) c /= sum;
+
+        // fixed-width IDs like SmallTrips.csv: ZONE007, ZONE123
+        size_t width = std::max<size_t>(3, std::to_string(n - 1).size());
+        names_.resize(n);
+        for (size_t r = 0; r < n; ++r) {
+            std::string digits = std::to_string(r);
+            names_[r] = "ZONE" + std::string(width - digits.size(), '0') + digits;
+        }
+        std::shuffle(names_.begin(), names_.end(), rng_);
+    }
+
+    const std::string& next() {
+        double u = pick_(rng_);
+        size_t r = (size_t)(std::lower_bound(cdf_.begin(), cdf_.end(), u) - cdf_.begin());
+        return names_[std::min(r, names_.size() - 1)];
+    }
+
+private:
+    std::mt19937_64& rng_;
+    std::uniform_real_distribution<double> pick_;
+    std::vector<double> cdf_;
+    std::vector<std::string> names_;
+};
+
+static bool generate(const BenchConfig& cfg) {
+    std::ofstream out(cfg.path, std::ios::binary);
+    if (!out.is_open()) return false;
+
+    std::mt19937_64 rng(cfg.seed);
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    ZoneSampler zones(cfg, rng);
+
+    std::string buf;
+    buf.reserve(1 << 20);
+    buf += "TripID,PickupZoneID,DropoffZoneID,PickupDateTime,DistanceKm,FareAmount\n";
+
+    char row[256];
+    for (long long i = 0; i < cfg.rows; ++i) {
+        const std::string& pick = zones.next();
+        const std::string& drop = zones.next();
+        int month = 1 + (int)(rng() % 12), day = 1 + (int)(rng() % 28);
+        int hour = (int)(rng() % 24), minute = (int)(rng() % 60);
+        double km = 0.5 + unit(rng) * 40.0;
+        const char* q = unit(rng) < cfg.quoted ? "\"" : "";
+
+        if (unit(rng) < cfg.dirty) {
+            switch (rng() % 5) {
+            case 0: std::snprintf(row, sizeof(row), "%lld,,%s,2024-%02d-%02d %02d:%02d,%.1f,%.1f\n",
+                                  1000000 + i, drop.c_str(), month, day, hour, minute, km, km * 3.5);
+                    break;
+            case 1: std::snprintf(row, sizeof(row), "%lld,%s,%s,NOT_A_DATE,%.1f,%.1f\n",
+                                  1000000 + i, pick.c_str(), drop.c_str(), km, km * 3.5);
+                    break;
+            case 2: std::snprintf(row, sizeof(row), "%lld,%s,%s,2024-%02d-%02d %02d:%02d\n",
+                                  1000000 + i, pick.c_str(), drop.c_str(), month, day, hour, minute);
+                    break;
+            case 3: std::snprintf(row, sizeof(row), "%lld,%s,%s,2024-%02d-%02d 2%d:%02d,%.1f,%.1f\n",
+                                  1000000 + i, pick.c_str(), drop.c_str(), month, day, 4 + hour % 6, minute,
+                                  km, km * 3.5);
+                    break;
+            default: std::snprintf(row, sizeof(row), "\n");
+                    break;
+            }
+        } else {
+            std::snprintf(row, sizeof(row), "%lld,%s,%s,%s2024-%02d-%02d %02d:%02d%s,%.1f,%.1f\n",
+                          1000000 + i, pick.c_str(), drop.c_str(), q, month, day, hour, minute, q,
+                          km, km * 3.5);
+        }
+
+        buf += row;
+        if (buf.size() >= (1 << 20)) {
+            out.write(buf.data(), (std::streamsize)buf.size());
+            buf.clear();
+        }
+    }
+    out.write(buf.data(), (std::streamsize)buf.size());
+    return (bool)out;
+}
+
+static double percentile(std::vector<double> v, double p) {
+    if (v.empty()) return 0;
+    std::sort(v.begin(), v.end());
+    size_t i = (size_t)std::ceil(p * (double)v.size()) - 1;
+    return v[std::min(i, v.size() - 1)];
+}
+
+template <class Query>
+static void timeQuery(const char* name, int queries, Query q) {
+    std::vector<double> us;
+    us.reserve((size_t)queries);
+    size_t sink = 0;
+    for (int i = 0; i < queries; ++i) {
+        auto t0 = Clock::now();
+        sink += q();
+        us.push_back(msSince(t0) * 1000.0);
+    }
+    std::printf("%-22s p50_us=%.1f p99_us=%.1f (n=%d, results=%zu)\n", name,
+                percentile(us, 0.50), percentile(us, 0.99), queries, sink / (size_t)queries);
+}
+
+static double peakRssMb() {
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) != 0) return 0;
+    return (double)ru.ru_maxrss / 1024.0;    // ru_maxrss is KiB on Linux
+}
+
+int main(int argc, char** argv) {
+    BenchConfig cfg;
+    if (!parseArgs(argc, argv, cfg)) return 2;
+
+    auto tg = Clock::now();
+    if (!generate(cfg)) {
+        std::cerr << "cannot write " << cfg.path << "\n";
+        return 1;
+    }
+    double genMs = msSince(tg);
+
+    std::ifstream probe(cfg.path, std::ios::binary | std::ios::ate);
+    double fileMb = (double)probe.tellg() / (1024.0 * 1024.0);
+    probe.close();
+
+    double rssBefore = peakRssMb();
+
+    AnalyzerOptions opts;
+    opts.threads = cfg.threads;
+    opts.rankingCache = cfg.cache;
+
+    TripAnalyzer analyzer;
+    analyzer.setOptions(opts);
+
+    std::vector<double> ingestMs;
+    for (int r = 0; r < cfg.reps; ++r) {
+        auto t0 = Clock::now();
+        analyzer.ingestFile(cfg.path);
+        ingestMs.push_back(msSince(t0));
+    }
+    double ms = percentile(ingestMs, 0.5);
+
+    std::printf("BENCH rows=%lld zones=%lld zipf=%.2f dirty=%.3f quoted=%.3f threads=%u seed=%llu\n",
+                cfg.rows, cfg.zones, cfg.zipf, cfg.dirty, cfg.quoted, cfg.threads, cfg.seed);
+    std::printf("%-22s %.2f\n", "file_mb", fileMb);
+    std::printf("%-22s %.1f\n", "generate_ms", genMs);
+    std::printf("%-22s %.1f (median of %d)\n", "ingest_ms", ms, cfg.reps);
+    std::printf("%-22s %.0f\n", "rows_per_sec", ms > 0 ? (double)cfg.rows / (ms / 1000.0) : 0.0);
+    std::printf("%-22s %.1f\n", "mb_per_sec", ms > 0 ? fileMb / (ms / 1000.0) : 0.0);
+    std::printf("%-22s %.1f (before ingest %.1f)\n", "peak_rss_mb", peakRssMb(), rssBefore);
+
+    char name[64];
+    std::snprintf(name, sizeof(name), "topZones(%d)", cfg.k);
+    timeQuery(name, cfg.queries, [&] { return analyzer.topZones(cfg.k).size(); });
+    std::snprintf(name, sizeof(name), "topBusySlots(%d)", cfg.k);
+    timeQuery(name, cfg.queries, [&] { return analyzer.topBusySlots(cfg.k).size(); });
+
+    if (!cfg.keep) std::remove(cfg.path.c_str());
+    return 0;
+}
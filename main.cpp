@@ -1,31 +1,29 @@
 #include "analyzer.h"
+#include "profiler.h"
+#include "report_writer.h"
 #include <iostream>
 #include <chrono>
-
-static void printZones(const std::vector<ZoneCount>& v) {
-    std::cout << "TOP_ZONES\n";
-    for (auto& x : v)
-        std::cout << x.zone << "," << x.count << "\n";
-}
-
-static void printSlots(const std::vector<SlotCount>& v) {
-    std::cout << "TOP_SLOTS\n";
-    for (auto& x : v)
-        std::cout << x.zone << "," << x.hour << "," << x.count << "\n";
-}
+#include <unistd.h>
 
 int main() {
     auto t0 = std::chrono::high_resolution_clock::now();
 
+    PhaseProfiler profile;    // counts only in `make profile` builds
     TripAnalyzer analyzer;
-    analyzer.ingestFile("SmallTrips.csv");
+    profile.phase("ingest", [&] { analyzer.ingestFile("SmallTrips.csv"); });
 
-    printZones(analyzer.topZones(10));
-    printSlots(analyzer.topBusySlots(10));
+    ReportWriter out(STDOUT_FILENO);
+    profile.phase("top_zones", [&] { out.writeZones(analyzer, 10); });
+    profile.phase("top_slots", [&] { out.writeSlots(analyzer, 10); });
+    out.flush();
 
     auto t1 = std::chrono::high_resolution_clock::now();
     auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(t1 - t0).count();
 
     std::cout << "EXEC_MS\n" << ms << "\n";
+#ifdef TRIP_PROFILE
+    // ingestStats() walks the zone table, so only ask when it is reported
+    profile.report(std::cout, analyzer.ingestStats().rowsRead);
+#endif
     return 0;
 }
@@ -0,0 +1,142 @@
+#include "profiler.h"
+
+#ifdef TRIP_PROFILE
+
+#include <chrono>
+#include <cerrno>
+#include <cstring>
+#include <iomanip>
+#include <ostream>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+struct EventSpec {
+    const char* name;
+    uint32_t type;
+    uint64_t config;
+};
+
+#ifdef __linux__
+// PERF_COUNT_HW_CACHE_MISSES is the kernel's generic last-level cache miss event
+const EventSpec kSpecs[] = {
+    {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {"llc_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    {"branch_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+};
+
+int openCounter(const EventSpec& spec) {
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = spec.type;
+    attr.config = spec.config;
+    attr.inherit = 1;           // include worker threads started later
+    attr.exclude_kernel = 1;    // allowed at perf_event_paranoid 2
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+}
+
+// Count so far, scaled up if the kernel multiplexed the counter
+uint64_t readCounter(int fd) {
+    uint64_t v[3];
+    if (fd < 0 || ::read(fd, v, sizeof(v)) != (ssize_t)sizeof(v)) return 0;
+    if (v[2] == 0) return 0;
+    return v[2] == v[1] ? v[0] : (uint64_t)((double)v[0] * (double)v[1] / (double)v[2]);
+}
+#else
+const EventSpec kSpecs[] = {{"cycles", 0, 0}, {"instructions", 0, 0}, {"llc_misses", 0, 0}, {"branch_misses", 0, 0}};
+#endif
+
+double nowMs() {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+}  // namespace
+
+PhaseProfiler::PhaseProfiler() {
+    for (int i = 0; i < kEvents; ++i) {
+#ifdef __linux__
+        fds_[i] = openCounter(kSpecs[i]);
+        if (fds_[i] < 0 && error_.empty()) {
+            error_ = std::string(kSpecs[i].name) + ": " + std::strerror(errno);
+            if (errno == EACCES || errno == EPERM) error_ += " (see /proc/sys/kernel/perf_event_paranoid)";
+        }
+#else
+        fds_[i] = -1;
+        error_ = "perf_event needs Linux";
+#endif
+    }
+}
+
+PhaseProfiler::~PhaseProfiler() {
+#ifdef __linux__
+    for (int fd : fds_) {
+        if (fd >= 0) ::close(fd);
+    }
+#endif
+}
+
+PhaseProfiler::Sample PhaseProfiler::sample() const {
+    Sample s;
+    s.ms = nowMs();
+    for (int i = 0; i < kEvents; ++i) {
+#ifdef __linux__
+        s.values[i] = readCounter(fds_[i]);
+#else
+        s.values[i] = 0;
+#endif
+    }
+    return s;
+}
+
+void PhaseProfiler::record(const char* name, const Sample& start) {
+    Sample end = sample();
+    Phase p{name, {end.ms - start.ms, {}}};
+    for (int i = 0; i < kEvents; ++i) p.delta.values[i] = end.values[i] - start.values[i];
+    phases_.push_back(p);
+}
+
+void PhaseProfiler::report(std::ostream& out, unsigned long long rows) const {
+    out << "PROFILE\n";
+    if (!error_.empty()) out << "# counters unavailable: " << error_ << "\n";
+    out << "phase,ms";
+    for (const EventSpec& spec : kSpecs) out << "," << spec.name;
+    out << ",ipc";
+    for (int i = 0; i < kEvents; ++i) {
+        if (i != 1) out << "," << kSpecs[i].name << "_per_row";    // instructions per row adds little
+    }
+    out << "\n";
+
+    std::ios::fmtflags flags = out.flags();
+    std::streamsize precision = out.precision();
+    out << std::fixed << std::setprecision(3);
+    for (const Phase& p : phases_) {
+        out << p.name << "," << p.delta.ms;
+        for (int i = 0; i < kEvents; ++i) {
+            if (fds_[i] >= 0) out << "," << p.delta.values[i];
+            else out << ",-";
+        }
+
+        const uint64_t* v = p.delta.values;
+        if (fds_[0] >= 0 && fds_[1] >= 0 && v[0]) out << "," << (double)v[1] / (double)v[0];
+        else out << ",-";
+        for (int i = 0; i < kEvents; ++i) {
+            if (i == 1) continue;
+            if (fds_[i] >= 0 && rows) out << "," << (double)v[i] / (double)rows;
+            else out << ",-";
+        }
+        out << "\n";
+    }
+    out.flags(flags);
+    out.precision(precision);
+}
+
+#endif  // TRIP_PROFILE
@@ -0,0 +1,55 @@
+#pragma once
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+// Per-phase wall time and hardware counters (cycles, instructions, LLC
+// misses, branch misses) for the `make profile` build. Counters follow the
+// calling thread and the threads it starts, user space only. Where
+// perf_event_open is unavailable the phases are still timed and the counters
+// print as "-". Without TRIP_PROFILE every call is a no-op.
+class PhaseProfiler {
+public:
+#ifdef TRIP_PROFILE
+    PhaseProfiler();
+    ~PhaseProfiler();
+    PhaseProfiler(const PhaseProfiler&) = delete;
+    PhaseProfiler& operator=(const PhaseProfiler&) = delete;
+
+    template <class F>
+    void phase(const char* name, F&& f) {
+        Sample start = sample();
+        f();
+        record(name, start);
+    }
+
+    // A PROFILE section: one line per phase, with per-row figures over `rows`
+    void report(std::ostream& out, unsigned long long rows) const;
+
+private:
+    static constexpr int kEvents = 4;
+
+    struct Sample {
+        double ms;
+        uint64_t values[kEvents];
+    };
+    struct Phase {
+        std::string name;
+        Sample delta;
+    };
+
+    Sample sample() const;
+    void record(const char* name, const Sample& start);
+
+    int fds_[kEvents];
+    std::string error_;          // why some counter could not be opened
+    std::vector<Phase> phases_;
+#else
+    template <class F>
+    void phase(const char*, F&& f) {
+        f();
+    }
+    void report(std::ostream&, unsigned long long) const {}
+#endif
+};
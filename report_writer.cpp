@@ -0,0 +1,138 @@
+#include "report_writer.h"
+
+#include <cerrno>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+
+#include <unistd.h>
+
+static constexpr size_t kBufferBytes = 1 << 20;
+
+ReportWriter::ReportWriter(int fd, ReportFormat format)
+    : fd_(fd), format_(format), buf_(new char[kBufferBytes]) {
+    if (format_ == ReportFormat::Binary) put("TRIPRPT1");
+}
+
+ReportWriter::~ReportWriter() { flush(); }
+
+void ReportWriter::beginZones() {
+    if (format_ == ReportFormat::Text) put("TOP_ZONES\n");
+    else if (format_ == ReportFormat::Csv) put("zone,count\n");
+}
+
+void ReportWriter::beginSlots() {
+    if (format_ == ReportFormat::Text) put("TOP_SLOTS\n");
+    else if (format_ == ReportFormat::Csv) put("zone,hour,count\n");
+}
+
+void ReportWriter::zone(std::string_view zone, long long count) {
+    if (format_ == ReportFormat::Binary) {
+        put("Z");
+        putLe(zone.size(), 4);
+        put(zone);
+        putLe((uint64_t)count, 8);
+        return;
+    }
+    putName(zone);
+    put(",");
+    putInt(count);
+    put("\n");
+}
+
+void ReportWriter::slot(std::string_view zone, int hour, long long count) {
+    if (format_ == ReportFormat::Binary) {
+        put("S");
+        putLe(zone.size(), 4);
+        put(zone);
+        putLe((uint64_t)hour, 1);
+        putLe((uint64_t)count, 8);
+        return;
+    }
+    putName(zone);
+    put(",");
+    putInt(hour);
+    put(",");
+    putInt(count);
+    put("\n");
+}
+
+void ReportWriter::writeZones(const TripAnalyzer& analyzer, int k) {
+    beginZones();
+    analyzer.visitTopZones(k, [this](std::string_view z, long long count) { zone(z, count); });
+}
+
+void ReportWriter::writeSlots(const TripAnalyzer& analyzer, int k) {
+    beginSlots();
+    analyzer.visitTopBusySlots(k, [this](std::string_view z, int hour, long long count) { slot(z, hour, count); });
+}
+
+void ReportWriter::writeZones(const std::vector<ZoneCount>& zones) {
+    beginZones();
+    for (const ZoneCount& z : zones) zone(z.zone, z.count);
+}
+
+void ReportWriter::writeSlots(const std::vector<SlotCount>& slots) {
+    beginSlots();
+    for (const SlotCount& s : slots) slot(s.zone, s.hour, s.count);
+}
+
+bool ReportWriter::flush() {
+    writeAll(buf_.get(), used_);
+    used_ = 0;
+    return ok_;
+}
+
+// Text keeps names as they are; CSV quotes the ones that need it (RFC 4180)
+void ReportWriter::putName(std::string_view zone) {
+    if (format_ != ReportFormat::Csv || zone.find_first_of(",\"\r\n") == std::string_view::npos) {
+        put(zone);
+        return;
+    }
+    put("\"");
+    for (size_t q; (q = zone.find('"')) != std::string_view::npos; zone.remove_prefix(q + 1)) {
+        put(zone.substr(0, q + 1));
+        put("\"");
+    }
+    put(zone);
+    put("\"");
+}
+
+void ReportWriter::put(std::string_view s) {
+    if (s.size() > kBufferBytes) {
+        flush();
+        writeAll(s.data(), s.size());
+        return;
+    }
+    reserve(s.size());
+    std::memcpy(buf_.get() + used_, s.data(), s.size());
+    used_ += s.size();
+}
+
+void ReportWriter::putInt(long long v) {
+    reserve(20);
+    char* p = buf_.get() + used_;
+    used_ = (size_t)(std::to_chars(p, p + 20, v).ptr - buf_.get());
+}
+
+void ReportWriter::putLe(uint64_t v, int bytes) {
+    reserve((size_t)bytes);
+    for (int i = 0; i < bytes; ++i) buf_[used_++] = (char)(v >> (8 * i));
+}
+
+void ReportWriter::reserve(size_t n) {
+    if (kBufferBytes - used_ < n) flush();
+}
+
+void ReportWriter::writeAll(const char* p, size_t n) {
+    while (ok_ && n) {
+        ssize_t w = ::write(fd_, p, n);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) {
+            ok_ = false;
+            break;
+        }
+        p += w;
+        n -= (size_t)w;
+    }
+}
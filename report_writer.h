@@ -0,0 +1,57 @@
+#pragma once
+#include "analyzer.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+enum class ReportFormat {
+    Text,      // TOP_ZONES / TOP_SLOTS sections of "zone,count" / "zone,hour,count" lines
+    Csv,       // a "zone,count" / "zone,hour,count" header row per section, names quoted as needed
+    Binary,    // "TRIPRPT1", then little-endian records (see ReportWriter)
+};
+
+// Buffered report output on a file descriptor, for rankings too long for
+// iostreams. Integers are formatted with std::to_chars into a 1 MiB buffer
+// that goes out in whole write() calls. The fd is not closed. Not thread-safe.
+//
+// Binary records: 'Z', u32 name length, name, i64 count for zones; 'S', u32
+// name length, name, u8 hour, i64 count for slots. Sections have no marker.
+class ReportWriter {
+public:
+    explicit ReportWriter(int fd, ReportFormat format = ReportFormat::Text);
+    ~ReportWriter();    // flushes
+    ReportWriter(const ReportWriter&) = delete;
+    ReportWriter& operator=(const ReportWriter&) = delete;
+
+    void beginZones();
+    void zone(std::string_view zone, long long count);
+    void beginSlots();
+    void slot(std::string_view zone, int hour, long long count);
+
+    // A whole section: header, then every entry
+    void writeZones(const TripAnalyzer& analyzer, int k);
+    void writeSlots(const TripAnalyzer& analyzer, int k);
+    void writeZones(const std::vector<ZoneCount>& zones);
+    void writeSlots(const std::vector<SlotCount>& slots);
+
+    // Writes out the buffer. False once any write has failed; later output
+    // is dropped.
+    bool flush();
+    bool ok() const noexcept { return ok_; }
+
+private:
+    void put(std::string_view s);
+    void putName(std::string_view zone);
+    void putInt(long long v);
+    void putLe(uint64_t v, int bytes);
+    void reserve(size_t n);
+    void writeAll(const char* p, size_t n);
+
+    int fd_;
+    ReportFormat format_;
+    std::unique_ptr<char[]> buf_;
+    size_t used_ = 0;
+    bool ok_ = true;
+};
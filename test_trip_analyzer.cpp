@@ -1,10 +1,24 @@
 #include "analyzer.h"
+#include "report_writer.h"
 #include "catch_amalgamated.hpp"
 
+#include <algorithm>
+#include <atomic>
 #include <fstream>
+#include <iterator>
+#include <limits>
 #include <string>
 #include <vector>
 #include <cstdio>   // std::remove
+#include <thread>
+#include <unistd.h> // pipe
+
+#ifdef TRIP_HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef TRIP_HAVE_ZSTD
+#include <zstd.h>
+#endif
 
 // ------------------- helpers -------------------
 static void writeFile(const std::string& path, const std::vector<std::string>& lines) {
@@ -23,6 +37,20 @@ static bool hasSlot(const std::vector<SlotCount>& v, const std::string& zone, in
     return false;
 }
 
+static bool sameZones(const std::vector<ZoneCount>& a, const std::vector<ZoneCount>& b) {
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); ++i)
+        if (a[i].zone != b[i].zone || a[i].count != b[i].count) return false;
+    return true;
+}
+
+static bool sameSlots(const std::vector<SlotCount>& a, const std::vector<SlotCount>& b) {
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); ++i)
+        if (a[i].zone != b[i].zone || a[i].hour != b[i].hour || a[i].count != b[i].count) return false;
+    return true;
+}
+
 static const char* HDR = "TripID,PickupZoneID,DropoffZoneID,PickupDateTime,DistanceKm,FareAmount";
 
 // ------------------- A: ingestion robustness -------------------
@@ -281,3 +309,1401 @@ TEST_CASE("C3", "[C3]") {
 
     std::remove(path.c_str());
 }
+
+// ------------------- D: extended API -------------------
+
+TEST_CASE("D1 parallel ingest matches serial", "[D1]") {
+    const std::string path = "d1.csv";
+
+    std::ofstream out(path);
+    REQUIRE(out.is_open());
+    out << HDR << "\n";
+    for (int i = 0; i < 40000; ++i) {
+        char buf[32];
+        std::snprintf(buf, sizeof(buf), "2024-01-01 %02d:%02d", (i * 7) % 24, i % 60);
+        out << i << ",ZONE_" << (i * 31) % 5003 << ",ZX," << buf << ",1.0,5.0\n";
+        if (i % 97 == 0) out << "broken,row\n";
+    }
+    out.close();
+
+    TripAnalyzer serial;
+    AnalyzerOptions one;
+    one.threads = 1;
+    serial.setOptions(one);
+    serial.ingestFile(path);
+
+    TripAnalyzer parallel;
+    AnalyzerOptions many;
+    many.threads = 8;
+    many.parallelMinBytes = 0;
+    parallel.setOptions(many);
+    parallel.ingestFile(path);
+
+    REQUIRE(serial.topZones(5003).size() == 5003);
+    REQUIRE(sameZones(serial.topZones(100000), parallel.topZones(100000)));
+    REQUIRE(sameSlots(serial.topBusySlots(50), parallel.topBusySlots(50)));
+
+    std::remove(path.c_str());
+}
+
+TEST_CASE("D2 analyzers are independent", "[D2]") {
+    const std::string pathA = "d2a.csv", pathB = "d2b.csv";
+    writeFile(pathA, {HDR, "1,ZONE_A,ZX,2024-01-01 10:00,1,1"});
+    writeFile(pathB, {HDR, "1,ZONE_B,ZX,2024-01-01 11:00,1,1", "2,ZONE_B,ZX,2024-01-01 11:00,1,1"});
+
+    // many live instances must not disturb each other
+    std::vector<TripAnalyzer> many(250);
+    for (auto& ta : many) ta.ingestFile(pathA);
+    REQUIRE(hasZone(many.front().topZones(), "ZONE_A", 1));
+
+    TripAnalyzer a, b;
+    std::thread ta([&] { a.ingestFile(pathA); });
+    std::thread tb([&] { b.ingestFile(pathB); });
+    ta.join();
+    tb.join();
+
+    REQUIRE(a.topZones().size() == 1);
+    REQUIRE(hasZone(a.topZones(), "ZONE_A", 1));
+    REQUIRE(b.topZones().size() == 1);
+    REQUIRE(hasSlot(b.topBusySlots(), "ZONE_B", 11, 2));
+
+    std::remove(pathA.c_str());
+    std::remove(pathB.c_str());
+}
+
+TEST_CASE("D3 appendFile and chunked ingestBuffer accumulate", "[D3]") {
+    const std::string pathA = "d3a.csv", pathB = "d3b.csv";
+    writeFile(pathA, {HDR, "1,ZONE_A,ZX,2024-01-01 10:00,1,1", "2,ZONE_B,ZX,2024-01-01 10:00,1,1"});
+    writeFile(pathB, {HDR, "3,ZONE_A,ZX,2024-01-01 11:00,1,1", "4,,ZX,2024-01-01 11:00,1,1"});
+
+    TripAnalyzer ta;
+    ta.ingestFile(pathA);
+    ta.appendFile(pathB);
+    REQUIRE(hasZone(ta.topZones(), "ZONE_A", 2));
+    REQUIRE(hasZone(ta.topZones(), "ZONE_B", 1));
+    REQUIRE(hasSlot(ta.topBusySlots(), "ZONE_A", 11, 1));
+
+    // ingestFile still starts from scratch
+    ta.ingestFile(pathB);
+    REQUIRE(ta.topZones().size() == 1);
+
+    // same rows fed in small chunks, split anywhere (header and rows included)
+    const std::string csv = std::string(HDR) + "\n"
+        "1,ZONE_A,ZX,2024-01-01 10:00,1,1\n"
+        "2,ZONE_B,ZX,2024-01-01 10:00,1,1\n"
+        "junk\n"
+        "3,ZONE_A,ZX,2024-01-01 11:00,1,1";
+    for (size_t chunk = 1; chunk <= 9; ++chunk) {
+        TripAnalyzer tb;
+        for (size_t off = 0; off < csv.size(); off += chunk)
+            tb.ingestBuffer(csv.data() + off, std::min(chunk, csv.size() - off));
+        tb.finishBuffer();
+
+        auto topZ = tb.topZones();
+        REQUIRE(topZ.size() == 2);
+        REQUIRE(hasZone(topZ, "ZONE_A", 2));
+        REQUIRE(hasZone(topZ, "ZONE_B", 1));
+        REQUIRE(hasSlot(tb.topBusySlots(), "ZONE_A", 11, 1));
+    }
+
+    std::remove(pathA.c_str());
+    std::remove(pathB.c_str());
+}
+
+TEST_CASE("D4 cached rankings follow ingests", "[D4]") {
+    const std::string pathA = "d4a.csv", pathB = "d4b.csv";
+    writeFile(pathA, {HDR,
+        "1,ZONE_C,ZX,2024-01-01 10:00,1,1",
+        "2,ZONE_B,ZX,2024-01-01 10:00,1,1",
+        "3,ZONE_B,ZX,2024-01-01 11:00,1,1",
+        "4,ZONE_A,ZX,2024-01-01 12:00,1,1"});
+    writeFile(pathB, {HDR,
+        "5,ZONE_A,ZX,2024-01-01 12:00,1,1",
+        "6,ZONE_A,ZX,2024-01-01 12:00,1,1"});
+
+    TripAnalyzer cached, uncached;
+    AnalyzerOptions off;
+    off.rankingCache = false;
+    uncached.setOptions(off);
+
+    cached.ingestFile(pathA);
+    uncached.ingestFile(pathA);
+    for (int k : {1, 3, 2, 10, 0, 2}) {
+        REQUIRE(sameZones(cached.topZones(k), uncached.topZones(k)));
+        REQUIRE(sameSlots(cached.topBusySlots(k), uncached.topBusySlots(k)));
+    }
+    REQUIRE(cached.topZones(1)[0].zone == "ZONE_B");
+
+    cached.appendFile(pathB);
+    uncached.appendFile(pathB);
+    REQUIRE(cached.topZones(1)[0].zone == "ZONE_A");
+    REQUIRE(sameZones(cached.topZones(3), uncached.topZones(3)));
+    REQUIRE(sameSlots(cached.topBusySlots(1), uncached.topBusySlots(1)));
+
+    std::remove(pathA.c_str());
+    std::remove(pathB.c_str());
+}
+
+TEST_CASE("D5 snapshot round trip", "[D5]") {
+    const std::string path = "d5.csv", snap = "d5.snap";
+    writeFile(path, {HDR,
+        "1,ZONE_B,ZX,2024-01-01 10:00,1,1",
+        "2,ZONE_A,ZX,2024-01-01 10:00,1,1",
+        "3,ZONE_B,ZX,2024-01-01 23:00,1,1",
+        "4,zone_a,ZX,2024-01-01 00:00,1,1"});
+
+    TripAnalyzer src;
+    src.ingestFile(path);
+    REQUIRE(src.saveSnapshot(snap));
+
+    TripAnalyzer loaded;
+    REQUIRE(loaded.loadSnapshot(snap));
+    REQUIRE(sameZones(loaded.topZones(10), src.topZones(10)));
+    REQUIRE(sameSlots(loaded.topBusySlots(10), src.topBusySlots(10)));
+
+    // appending on top of a loaded snapshot keeps its counts
+    loaded.appendFile(path);
+    REQUIRE(hasZone(loaded.topZones(), "ZONE_B", 4));
+    REQUIRE(hasSlot(loaded.topBusySlots(), "zone_a", 0, 2));
+
+    // a flipped byte fails validation and leaves the analyzer untouched
+    {
+        std::fstream f(snap, std::ios::in | std::ios::out | std::ios::binary);
+        f.seekp(-3, std::ios::end);
+        f.put('\x7f');
+    }
+    REQUIRE_FALSE(loaded.loadSnapshot(snap));
+    REQUIRE_FALSE(loaded.loadSnapshot("missing_snapshot_hopefully_123.snap"));
+    REQUIRE(hasZone(loaded.topZones(), "ZONE_B", 4));
+
+    std::remove(path.c_str());
+    std::remove(snap.c_str());
+}
+
+TEST_CASE("D6 counts stay exact past narrow counter range", "[D6]") {
+    const std::string path = "d6.csv";
+
+    // 70k trips in one slot overflows a 16-bit cell (TRIP_COUNTER_BITS=16,
+    // `make test16`); D25 covers the default 32-bit cells
+    std::ofstream out(path);
+    REQUIRE(out.is_open());
+    out << HDR << "\n";
+    for (int i = 0; i < 70000; ++i) out << i << ",ZONE_HOT,ZX,2024-01-01 05:10,1.0,5.0\n";
+    for (int i = 0; i < 300; ++i) out << i << ",ZONE_HOT,ZX,2024-01-01 06:10,1.0,5.0\n";
+    out.close();
+
+    TripAnalyzer ta;
+    AnalyzerOptions many;
+    many.threads = 4;
+    many.parallelMinBytes = 0;
+    ta.setOptions(many);
+    ta.ingestFile(path);
+    ta.appendFile(path);
+
+    auto topZ = ta.topZones(1);
+    REQUIRE(topZ.size() == 1);
+    REQUIRE(topZ[0].count == 140600);
+
+    auto topS = ta.topBusySlots(2);
+    REQUIRE(topS.size() == 2);
+    REQUIRE(hasSlot(topS, "ZONE_HOT", 5, 140000));
+    REQUIRE(hasSlot(topS, "ZONE_HOT", 6, 600));
+
+    std::remove(path.c_str());
+}
+
+TEST_CASE("D7 extended columns: dropoffs, fare and distance", "[D7]") {
+    const std::string path = "d7.csv";
+    writeFile(path, {
+        HDR,
+        "1,ZONE_A,ZONE_B,2024-01-01 09:00,2.5,10.25",
+        "2,ZONE_A,ZONE_B,2024-01-01 09:30,\"1.5\",\"4.75\"",
+        "3,ZONE_A,ZONE_C,2024-01-01 10:00,abc,7\r",
+        "4,ZONE_A,,2024-01-01 10:00,1.0,",
+        "5,ZONE_C,ZONE_B,NOT_A_DATE,1.0,1.0"
+    });
+
+    // off by default: dropoff-only zones never show up in pickup rankings
+    TripAnalyzer plain;
+    plain.ingestFile(path);
+    REQUIRE(plain.topDropoffZones().empty());
+    REQUIRE(plain.topZones().size() == 1);
+
+    TripAnalyzer ta;
+    AnalyzerOptions ext;
+    ext.extendedColumns = true;
+    ta.setOptions(ext);
+    ta.ingestFile(path);
+
+    REQUIRE(sameZones(ta.topZones(), plain.topZones()));
+    REQUIRE(sameSlots(ta.topBusySlots(), plain.topBusySlots()));
+
+    auto drops = ta.topDropoffZones(5);
+    REQUIRE(drops.size() == 2);
+    REQUIRE(hasZone(drops, "ZONE_B", 2));
+    REQUIRE(hasZone(drops, "ZONE_C", 1));
+
+    auto totals = ta.slotTotals("ZONE_A");
+    REQUIRE(totals.size() == 2);
+    REQUIRE(totals[0].hour == 9);
+    REQUIRE(totals[0].count == 2);
+    REQUIRE(totals[0].revenue == Catch::Approx(15.0));
+    REQUIRE(totals[0].distanceKm == Catch::Approx(4.0));
+    REQUIRE(totals[1].hour == 10);
+    REQUIRE(totals[1].count == 2);
+    REQUIRE(totals[1].revenue == Catch::Approx(7.0));
+    REQUIRE(totals[1].distanceKm == Catch::Approx(1.0));
+    REQUIRE(ta.slotTotals("ZONE_MISSING").empty());
+
+    // parallel shards merge to the same totals
+    TripAnalyzer par;
+    ext.threads = 3;
+    ext.parallelMinBytes = 0;
+    par.setOptions(ext);
+    par.ingestFile(path);
+    REQUIRE(sameZones(par.topDropoffZones(5), drops));
+    REQUIRE(par.slotTotals("ZONE_A")[0].revenue == Catch::Approx(15.0));
+
+    std::remove(path.c_str());
+}
+
+TEST_CASE("D8 top routes over pickup/dropoff pairs", "[D8]") {
+    const std::string path = "d8.csv";
+    std::ofstream out(path);
+    REQUIRE(out.is_open());
+    out << HDR << "\n";
+    // 300 zones so pairs outnumber zones and the table grows several times
+    for (int i = 0; i < 3000; ++i)
+        out << i << ",Z" << i % 300 << ",Z" << (i * 7) % 300 << ",2024-01-01 05:10,1.0,5.0\n";
+    out << "9001,Z1,Z2,2024-01-01 05:10,1.0,5.0\n";
+    out << "9002,Z1,Z2,2024-01-01 05:10,1.0,5.0\n";
+    out << "9003,Z0,Z9,2024-01-01 05:10,1.0,5.0\n";
+    out << "9004,Z0,Z9,2024-01-01 05:10,1.0,5.0\n";
+    out << "9005,Z0,,2024-01-01 05:10,1.0,5.0\n";
+    out << "9006,Z5,Z9,BAD,1.0,5.0\n";
+    out.close();
+
+    AnalyzerOptions ext;
+    ext.extendedColumns = true;
+    TripAnalyzer ta;
+    ta.setOptions(ext);
+    ta.ingestFile(path);
+
+    // the 300 generated pairs repeat 10 times each; ties go by pickup, then dropoff
+    auto top = ta.topRoutes(3);
+    REQUIRE(top.size() == 3);
+    REQUIRE((top[0].pickup == "Z0" && top[0].dropoff == "Z0" && top[0].count == 10));
+    REQUIRE((top[1].pickup == "Z1" && top[1].dropoff == "Z7" && top[1].count == 10));
+    REQUIRE((top[2].pickup == "Z10" && top[2].dropoff == "Z70" && top[2].count == 10));
+
+    auto all = ta.topRoutes(1000);
+    REQUIRE(all.size() == 302);
+    REQUIRE((all[300].pickup == "Z0" && all[300].dropoff == "Z9" && all[300].count == 2));
+    REQUIRE((all[301].pickup == "Z1" && all[301].dropoff == "Z2" && all[301].count == 2));
+
+    // parallel shards merge pair counts exactly
+    TripAnalyzer par;
+    ext.threads = 4;
+    ext.parallelMinBytes = 0;
+    par.setOptions(ext);
+    par.ingestFile(path);
+    auto allPar = par.topRoutes(1000);
+    REQUIRE(all.size() == allPar.size());
+    for (size_t i = 0; i < all.size(); ++i) {
+        REQUIRE(all[i].pickup == allPar[i].pickup);
+        REQUIRE(all[i].dropoff == allPar[i].dropoff);
+        REQUIRE(all[i].count == allPar[i].count);
+    }
+
+    TripAnalyzer plain;
+    plain.ingestFile(path);
+    REQUIRE(plain.topRoutes().empty());
+
+    std::remove(path.c_str());
+}
+
+TEST_CASE("D9 date, weekday and 15-minute filters", "[D9]") {
+    const std::string path = "d9.csv";
+    writeFile(path, {
+        HDR,
+        "1,ZONE_A,ZX,2024-03-04 08:00,1,1",      // Monday
+        "2,ZONE_A,ZX,2024-03-04 08:14,1,1",
+        "3,ZONE_B,ZX,2024-03-09 08:20,1,1",      // Saturday
+        "4,ZONE_B,ZX,2024-03-10 17:45,1,1",      // Sunday
+        "5,ZONE_B,ZX,2024-04-01 09:00,1,1",      // Monday, April
+        "6,ZONE_C,ZX,\"2024-03-05 23:59\",1,1",  // Tuesday
+        "7,ZONE_C,ZX,2024-02-30 10:00,1,1",      // counted by hour, no bucket
+        "8,ZONE_C,ZX,2024-03-05 10:6,1,1"        // short minute field
+    });
+
+    AnalyzerOptions opts;
+    opts.timeBuckets = true;
+    TripAnalyzer ta;
+    ta.setOptions(opts);
+    ta.ingestFile(path);
+
+    // the unfiltered queries are unchanged
+    TripAnalyzer plain;
+    plain.ingestFile(path);
+    REQUIRE(sameZones(ta.topZones(), plain.topZones()));
+    REQUIRE(sameSlots(ta.topBusySlots(), plain.topBusySlots()));
+
+    TimeFilter all;
+    auto z = ta.topZones(10, all);
+    REQUIRE(z.size() == 3);
+    REQUIRE(hasZone(z, "ZONE_B", 3));
+    REQUIRE(hasZone(z, "ZONE_A", 2));
+    REQUIRE(hasZone(z, "ZONE_C", 1));
+
+    TimeFilter marchWeekdays;
+    marchWeekdays.fromDate = 20240301;
+    marchWeekdays.toDate = 20240331;
+    marchWeekdays.weekdays = 0x1f;
+    z = ta.topZones(10, marchWeekdays);
+    REQUIRE(z.size() == 2);
+    REQUIRE(hasZone(z, "ZONE_A", 2));
+    REQUIRE(hasZone(z, "ZONE_C", 1));
+
+    auto s = ta.topBusySlots(10, marchWeekdays);
+    REQUIRE(s.size() == 2);
+    REQUIRE(hasSlot(s, "ZONE_A", 8, 2));
+    REQUIRE(hasSlot(s, "ZONE_C", 23, 1));
+
+    // [08:15, 18:00) on weekends
+    TimeFilter weekendDay;
+    weekendDay.weekdays = 0x60;
+    weekendDay.fromMinute = 8 * 60 + 15;
+    weekendDay.toMinute = 18 * 60;
+    s = ta.topBusySlots(10, weekendDay);
+    REQUIRE(s.size() == 2);
+    REQUIRE(hasSlot(s, "ZONE_B", 8, 1));
+    REQUIRE(hasSlot(s, "ZONE_B", 17, 1));
+
+    TripAnalyzer par;
+    opts.threads = 3;
+    opts.parallelMinBytes = 0;
+    par.setOptions(opts);
+    par.ingestFile(path);
+    REQUIRE(sameZones(par.topZones(10, marchWeekdays), ta.topZones(10, marchWeekdays)));
+    REQUIRE(plain.topZones(10, all).empty());
+
+    std::remove(path.c_str());
+}
+
+TEST_CASE("D10 stream and fd ingest match file ingest", "[D10]") {
+    const std::string path = "d10.csv";
+    std::ofstream out(path);
+    REQUIRE(out.is_open());
+    out << HDR << "\n";
+    // enough rows to span several read buffers, so rows get split across reads
+    for (int i = 0; i < 120000; ++i)
+        out << i << ",ZONE_" << (i * 13) % 97 << ",ZX,2024-01-01 " << (i % 24 < 10 ? "0" : "") << i % 24
+            << ":00,1.0,5.0\n";
+    // one line longer than the buffer is dropped; its neighbours still count
+    out << "1," << std::string(3 << 20, 'x') << "\n";
+    out << "2,ZONE_LAST,ZX,2024-01-01 07:00,1.0,5.0";
+    out.close();
+
+    TripAnalyzer byFile;
+    byFile.ingestFile(path);
+    REQUIRE(hasZone(byFile.topZones(200), "ZONE_LAST", 1));
+
+    std::ifstream in(path, std::ios::binary);
+    TripAnalyzer byStream;
+    byStream.ingestStream(in);
+    REQUIRE(sameZones(byStream.topZones(200), byFile.topZones(200)));
+    REQUIRE(sameSlots(byStream.topBusySlots(50), byFile.topBusySlots(50)));
+
+    // a pipe cannot be mapped, so this takes the read() path
+    int fds[2];
+    REQUIRE(::pipe(fds) == 0);
+    std::thread writer([&] {
+        std::ifstream src(path, std::ios::binary);
+        char chunk[4096];
+        while (src.read(chunk, sizeof(chunk)) || src.gcount()) {
+            if (::write(fds[1], chunk, (size_t)src.gcount()) < 0) break;
+        }
+        ::close(fds[1]);
+    });
+    TripAnalyzer byFd;
+    byFd.ingestFd(fds[0]);
+    writer.join();
+    ::close(fds[0]);
+    REQUIRE(sameZones(byFd.topZones(200), byFile.topZones(200)));
+    REQUIRE(sameSlots(byFd.topBusySlots(50), byFile.topBusySlots(50)));
+
+    // append adds to what is there
+    std::ifstream again(path, std::ios::binary);
+    byStream.appendStream(again);
+    REQUIRE(hasZone(byStream.topZones(200), "ZONE_LAST", 2));
+
+    std::remove(path.c_str());
+}
+
+TEST_CASE("D11 gzip input is detected and inflated", "[D11]") {
+#ifndef TRIP_HAVE_ZLIB
+    SKIP("built without zlib");
+#else
+    const std::string path = "d11.csv";
+    const std::string gz = "d11.csv.gz";
+
+    std::string csv = std::string(HDR) + "\n";
+    for (int i = 0; i < 200000; ++i)
+        csv += std::to_string(i) + ",ZONE_" + std::to_string((i * 31) % 501) + ",ZX,2024-01-01 " +
+               (i % 24 < 10 ? "0" : "") + std::to_string(i % 24) + ":00,1.0,5.0\n";
+    {
+        std::ofstream out(path, std::ios::binary);
+        out << csv;
+    }
+
+    // two gzip members, split mid-row, like `cat a.gz b.gz`
+    size_t cut = csv.size() / 2 + 7;
+    for (int member = 0; member < 2; ++member) {
+        gzFile f = gzopen(gz.c_str(), member ? "ab" : "wb");
+        REQUIRE(f);
+        const std::string part = member ? csv.substr(cut) : csv.substr(0, cut);
+        REQUIRE(gzwrite(f, part.data(), (unsigned)part.size()) == (int)part.size());
+        gzclose(f);
+    }
+
+    TripAnalyzer plain;
+    plain.ingestFile(path);
+
+    TripAnalyzer byFile;
+    byFile.ingestFile(gz);
+    REQUIRE(sameZones(byFile.topZones(600), plain.topZones(600)));
+    REQUIRE(sameSlots(byFile.topBusySlots(100), plain.topBusySlots(100)));
+
+    // a compressed pipe is sniffed from its first bytes too
+    int fds[2];
+    REQUIRE(::pipe(fds) == 0);
+    std::thread writer([&] {
+        std::ifstream src(gz, std::ios::binary);
+        char chunk[4096];
+        while (src.read(chunk, sizeof(chunk)) || src.gcount()) {
+            if (::write(fds[1], chunk, (size_t)src.gcount()) < 0) break;
+        }
+        ::close(fds[1]);
+    });
+    TripAnalyzer byFd;
+    byFd.ingestFd(fds[0]);
+    writer.join();
+    ::close(fds[0]);
+    REQUIRE(sameZones(byFd.topZones(600), plain.topZones(600)));
+
+    // a truncated archive keeps the rows inflated before the cut
+    {
+        std::ifstream src(gz, std::ios::binary);
+        std::string bytes((std::istreambuf_iterator<char>(src)), std::istreambuf_iterator<char>());
+        std::ofstream out(gz, std::ios::binary | std::ios::trunc);
+        out.write(bytes.data(), (std::streamsize)(bytes.size() / 3));
+    }
+    TripAnalyzer cut3;
+    cut3.ingestFile(gz);
+    auto z = cut3.topZones(1);
+    REQUIRE(z.size() == 1);
+    REQUIRE(z[0].count < plain.topZones(1)[0].count);
+
+    std::remove(path.c_str());
+    std::remove(gz.c_str());
+#endif
+}
+
+TEST_CASE("D12 queries during ingest see whole published states", "[D12]") {
+    const std::string path = "d12.csv";
+    std::ofstream out(path);
+    REQUIRE(out.is_open());
+    out << HDR << "\n";
+    // every append adds 2000 trips to ZONE_A and 1000 to ZONE_B
+    for (int i = 0; i < 3000; ++i)
+        out << i << "," << (i % 3 ? "ZONE_A" : "ZONE_B") << ",ZX,2024-01-01 0" << i % 10 << ":00,1,1\n";
+    out.close();
+
+    AnalyzerOptions opts;
+    opts.concurrentReads = true;
+    opts.timeBuckets = true;
+    TripAnalyzer ta;
+    ta.setOptions(opts);
+    ta.ingestFile(path);
+
+    const int appends = 40;
+    std::atomic<bool> done{false};
+    std::atomic<int> torn{0}, reads{0};
+    auto reader = [&] {
+        long long last = 0;
+        while (!done.load() || reads.load() < 8) {
+            auto z = ta.topZones(2);
+            auto f = ta.topZones(2, TimeFilter{});
+            bool ok = z.size() == 2 && z[0].zone == "ZONE_A" && z[0].count == 2 * z[1].count &&
+                      z[0].count % 2000 == 0 && z[0].count >= last && f.size() == 2;
+            if (!ok) ++torn;
+            else last = z[0].count;
+            ++reads;
+        }
+    };
+    std::thread r1(reader), r2(reader);
+    for (int i = 0; i < appends; ++i) ta.appendFile(path);
+    done = true;
+    r1.join();
+    r2.join();
+
+    REQUIRE(torn.load() == 0);
+    auto z = ta.topZones(2);
+    REQUIRE(hasZone(z, "ZONE_A", 2000LL * (appends + 1)));
+    REQUIRE(hasZone(z, "ZONE_B", 1000LL * (appends + 1)));
+
+    // replacing ingest and a snapshot round trip keep working in this mode
+    ta.ingestFile(path);
+    REQUIRE(hasZone(ta.topZones(2), "ZONE_A", 2000));
+    REQUIRE(ta.saveSnapshot("d12.snap"));
+    ta.appendFile(path);
+    REQUIRE(ta.loadSnapshot("d12.snap"));
+    REQUIRE(hasZone(ta.topZones(2), "ZONE_A", 2000));
+
+    // switching the mode off keeps the state
+    opts.concurrentReads = false;
+    ta.setOptions(opts);
+    REQUIRE(hasZone(ta.topZones(2), "ZONE_B", 1000));
+    ta.appendFile(path);
+    REQUIRE(hasZone(ta.topZones(2), "ZONE_B", 2000));
+
+    std::remove(path.c_str());
+    std::remove("d12.snap");
+}
+
+TEST_CASE("D13 topMany matches separate top-k calls", "[D13]") {
+    const std::string path = "d13.csv";
+    std::ofstream out(path);
+    REQUIRE(out.is_open());
+    out << HDR << "\n";
+    for (int i = 0; i < 20000; ++i)
+        out << i << ",ZONE_" << (i * i) % 1301 << ",ZX,2024-01-01 " << (i % 24 < 10 ? "0" : "") << i % 24
+            << ":00,1,1\n";
+    out.close();
+
+    for (bool cache : {true, false}) {
+        AnalyzerOptions opts;
+        opts.rankingCache = cache;
+        TripAnalyzer ta;
+        ta.setOptions(opts);
+        ta.ingestFile(path);
+
+        TripAnalyzer ref;
+        ref.ingestFile(path);
+
+        const std::vector<int> zoneKs = {10, 1000, 0, 100, 5000};
+        const std::vector<int> slotKs = {3, 250};
+        TopKReport r = ta.topMany(zoneKs, slotKs);
+        REQUIRE(r.zones.size() == zoneKs.size());
+        REQUIRE(r.slots.size() == slotKs.size());
+        for (size_t i = 0; i < zoneKs.size(); ++i) REQUIRE(sameZones(r.zones[i], ref.topZones(zoneKs[i])));
+        for (size_t i = 0; i < slotKs.size(); ++i) REQUIRE(sameSlots(r.slots[i], ref.topBusySlots(slotKs[i])));
+
+        // later single queries agree with the batch
+        REQUIRE(sameZones(ta.topZones(37), ref.topZones(37)));
+        REQUIRE(ta.topMany({}, {}).zones.empty());
+    }
+
+    std::remove(path.c_str());
+}
+
+TEST_CASE("D14 ingest stats count rejections by reason", "[D14]") {
+    const std::string path = "d14.csv";
+    writeFile(path, {
+        HDR,
+        "1,ZONE_A,ZX,2024-01-01 09:00,1,1",
+        "2,ZONE_B,ZX,\"2024-01-01 10:00\",1,1",
+        "",
+        "3,ZONE_A,ZX,2024-01-01 09:00",          // missing fields
+        "4,,ZX,2024-01-01 09:00,1,1",            // empty zone
+        "5,ZONE_A,ZX,,1,1",                      // empty datetime
+        "6,ZONE_A,ZX,2024/01/01,1,1",            // malformed datetime
+        "7,ZONE_A,ZX,2024-01-01 25:00,1,1",      // hour out of range
+        "8,ZONE_C,ZX,2024-01-01 23:59,1,1"
+    });
+
+    for (unsigned threads : {1u, 4u}) {
+        AnalyzerOptions opts;
+        opts.threads = threads;
+        opts.parallelMinBytes = 0;
+        TripAnalyzer ta;
+        ta.setOptions(opts);
+        ta.ingestFile(path);
+
+        IngestStats st = ta.ingestStats();
+        REQUIRE(st.uniqueZones == 3);
+        REQUIRE(st.loadFactor > 0.0);
+        REQUIRE(st.loadFactor <= 0.5);
+        REQUIRE(st.meanProbeLength >= 1.0);
+#if !defined(TRIP_INGEST_STATS) || TRIP_INGEST_STATS
+        REQUIRE(st.rowsRead == 8);
+        REQUIRE(st.rowsAccepted == 3);
+        REQUIRE(st.missingFields == 1);
+        REQUIRE(st.emptyZone == 1);
+        REQUIRE(st.badDatetime == 2);
+        REQUIRE(st.badHour == 1);
+        REQUIRE(st.bytes > 0);
+        REQUIRE(st.parseMs >= 0.0);
+
+        // appends accumulate, a replacing ingest starts over
+        ta.appendFile(path);
+        REQUIRE(ta.ingestStats().rowsAccepted == 6);
+        ta.ingestFile(path);
+        REQUIRE(ta.ingestStats().rowsRead == 8);
+#endif
+    }
+
+    std::remove(path.c_str());
+}
+
+TEST_CASE("D15 merged partial analyzers match one analyzer", "[D15]") {
+    const int parts = 4;
+    std::vector<std::string> paths;
+    std::ofstream whole("d15_all.csv");
+    REQUIRE(whole.is_open());
+    whole << HDR << "\n";
+    for (int p = 0; p < parts; ++p) {
+        paths.push_back("d15_" + std::to_string(p) + ".csv");
+        std::ofstream out(paths.back());
+        REQUIRE(out.is_open());
+        out << HDR << "\n";
+        // overlapping zones with many count ties across parts
+        for (int i = 0; i < 5000; ++i) {
+            int id = p * 5000 + i;
+            std::string row = std::to_string(id) + ",Z" + std::to_string((id * 7) % 613) + ",ZX,2024-01-01 " +
+                              (id % 24 < 10 ? "0" : "") + std::to_string(id % 24) + ":00,1,1";
+            out << row << "\n";
+            whole << row << "\n";
+        }
+    }
+    whole.close();
+
+    TripAnalyzer single;
+    single.ingestFile("d15_all.csv");
+
+    std::vector<TripAnalyzer> nodes(parts);
+    for (int p = 0; p < parts; ++p) nodes[p].ingestFile(paths[p]);
+
+    // in-process tree reduction: (0+1) + (2+3)
+    TripAnalyzer left, right;
+    left.merge(nodes[0]);
+    left.merge(nodes[1]);
+    right.merge(nodes[2]);
+    right.merge(nodes[3]);
+    left.merge(right);
+    REQUIRE(sameZones(left.topZones(1000), single.topZones(1000)));
+    REQUIRE(sameSlots(left.topBusySlots(500), single.topBusySlots(500)));
+
+    // the same over the wire
+    TripAnalyzer root;
+    for (auto& node : nodes) {
+        std::string wire = node.serializePartial();
+        REQUIRE(root.mergeSerialized(wire.data(), wire.size()));
+    }
+    REQUIRE(sameZones(root.topZones(1000), single.topZones(1000)));
+    REQUIRE(sameSlots(root.topBusySlots(500), single.topBusySlots(500)));
+
+    // re-encoding a merged state round-trips, and is smaller than the CSV
+    std::string wire = root.serializePartial();
+    TripAnalyzer again;
+    REQUIRE(again.mergeSerialized(wire.data(), wire.size()));
+    REQUIRE(sameZones(again.topZones(1000), single.topZones(1000)));
+    REQUIRE(wire.size() < 20000 * 10);
+
+    // damaged payloads are refused without touching the state
+    std::string bad = wire;
+    bad[bad.size() / 2] ^= 0x40;
+    REQUIRE_FALSE(again.mergeSerialized(bad.data(), bad.size()));
+    REQUIRE_FALSE(again.mergeSerialized(wire.data(), wire.size() - 1));
+    REQUIRE_FALSE(again.mergeSerialized(nullptr, 0));
+    REQUIRE(sameZones(again.topZones(1000), single.topZones(1000)));
+
+    // merging an analyzer into itself doubles it
+    again.merge(again);
+    REQUIRE(again.topZones(1)[0].count == 2 * single.topZones(1)[0].count);
+
+    for (auto& p : paths) std::remove(p.c_str());
+    std::remove("d15_all.csv");
+}
+
+TEST_CASE("D16 approximate mode keeps heavy hitters within the error bound", "[D16]") {
+    const std::string path = "d16.csv";
+    std::ofstream out(path);
+    REQUIRE(out.is_open());
+    out << HDR << "\n";
+    // 10 heavy zones over a long tail of 40k one-off zones
+    long long rows = 0;
+    for (int i = 0; i < 40000; ++i) {
+        out << rows++ << ",TAIL_" << i << ",ZX,2024-01-01 03:00,1,1\n";
+        if (i % 4 == 0) out << rows++ << ",HEAVY_" << i / 4 % 10 << ",ZX,2024-01-01 0" << i / 4 % 7 << ":00,1,1\n";
+    }
+    out.close();
+
+    TripAnalyzer exact;
+    exact.ingestFile(path);
+
+    AnalyzerOptions opts;
+    opts.approxCapacity = 500;
+    opts.threads = 4;               // ignored: approximate ingest is serial
+    opts.parallelMinBytes = 0;
+    TripAnalyzer approx;
+    approx.setOptions(opts);
+    approx.ingestFile(path);
+
+    const long long bound = rows / 500;
+    auto truth = exact.topZones(10);
+    auto est = approx.topZones(10);
+    REQUIRE(est.size() == 10);
+    for (const ZoneCount& t : truth) {
+        auto it = std::find_if(est.begin(), est.end(), [&](const ZoneCount& e) { return e.zone == t.zone; });
+        REQUIRE(it != est.end());
+        REQUIRE(it->count >= t.count);
+        REQUIRE(it->count <= t.count + bound);
+    }
+
+    // 70 heavy slots of ~143 trips, all above the bound, so all are monitored
+    auto slotTruth = exact.topBusySlots(70);
+    auto slotEst = approx.topBusySlots(70);
+    REQUIRE(slotEst.size() == 70);
+    for (const SlotCount& t : slotTruth) {
+        auto it = std::find_if(slotEst.begin(), slotEst.end(),
+                               [&](const SlotCount& e) { return e.zone == t.zone && e.hour == t.hour; });
+        REQUIRE(it != slotEst.end());
+        REQUIRE(it->count >= t.count);
+        REQUIRE(it->count <= t.count + bound);
+    }
+
+    // within capacity the sketch is exact
+    writeFile("d16_small.csv", {HDR, "1,ZONE_A,ZX,2024-01-01 10:00,1,1", "2,ZONE_B,ZX,2024-01-01 11:00,1,1",
+                                "3,ZONE_B,ZX,2024-01-01 11:00,1,1", "4,,ZX,2024-01-01 11:00,1,1"});
+    TripAnalyzer smallExact, smallApprox;
+    smallExact.ingestFile("d16_small.csv");
+    smallApprox.setOptions(opts);
+    smallApprox.ingestFile("d16_small.csv");
+    REQUIRE(sameZones(smallApprox.topZones(), smallExact.topZones()));
+    REQUIRE(sameSlots(smallApprox.topBusySlots(), smallExact.topBusySlots()));
+
+    std::remove(path.c_str());
+    std::remove("d16_small.csv");
+}
+
+TEST_CASE("D17 numeric zone IDs keep their own identity and order", "[D17]") {
+    const std::string path = "d17.csv";
+    std::vector<std::string> lines = {HDR};
+    // same number, different widths, plus shapes that must take the hash path
+    const std::vector<std::string> ids = {"ZONE7", "ZONE007", "ZONE07", "ZONE1234567", "ZONE", "ZONEX1",
+                                          "zone7", "ZONE12a", "ZONE000000", "ZONE999999"};
+    int id = 0;
+    for (int rep = 0; rep < 3; ++rep)
+        for (const auto& z : ids) lines.push_back(std::to_string(id++) + "," + z + ",ZX,2024-01-01 04:00,1,1");
+    lines.push_back(std::to_string(id++) + ",ZONE07,ZX,2024-01-01 05:00,1,1");
+    writeFile(path, lines);
+
+    TripAnalyzer ta;
+    ta.ingestFile(path);
+    auto z = ta.topZones(20);
+    REQUIRE(z.size() == ids.size());
+    REQUIRE(z[0].zone == "ZONE07");
+    REQUIRE(z[0].count == 4);
+    // the 3-count ties in plain string order
+    std::vector<std::string> expect = ids;
+    expect.erase(std::find(expect.begin(), expect.end(), "ZONE07"));
+    std::sort(expect.begin(), expect.end());
+    for (size_t i = 0; i < expect.size(); ++i) {
+        REQUIRE(z[i + 1].zone == expect[i]);
+        REQUIRE(z[i + 1].count == 3);
+    }
+
+    auto s = ta.topBusySlots(2);
+    REQUIRE(hasSlot(s, "ZONE", 4, 3));
+    REQUIRE(hasSlot(s, "ZONE000000", 4, 3));
+
+    std::remove(path.c_str());
+}
+
+TEST_CASE("D18 deep rankings break count ties by name across appends", "[D18]") {
+    const std::string path = "d18.csv";
+    // 30k zones in three count tiers, names out of numeric order and mixed shapes
+    auto nameOf = [](int i) {
+        return (i % 3 ? "Z" : "ZONE") + std::to_string((i * 7919) % 30011);
+    };
+    std::vector<std::pair<std::string, int>> truth;   // zone, count
+    std::ofstream out(path);
+    REQUIRE(out.is_open());
+    out << HDR << "\n";
+    long long id = 0;
+    for (int i = 0; i < 30000; ++i) {
+        int c = 1 + i % 3;
+        for (int r = 0; r < c; ++r) out << id++ << "," << nameOf(i) << ",ZX,2024-01-01 1" << r << ":00,1,1\n";
+        truth.emplace_back(nameOf(i), c);
+    }
+    out.close();
+
+    auto expectOrder = [&] {
+        std::vector<std::pair<std::string, int>> e = truth;
+        std::sort(e.begin(), e.end(), [](const auto& a, const auto& b) {
+            return a.second != b.second ? a.second > b.second : a.first < b.first;
+        });
+        return e;
+    };
+    auto check = [&](TripAnalyzer& ta) {
+        auto e = expectOrder();
+        auto z = ta.topZones((int)e.size() + 10);
+        REQUIRE(z.size() == e.size());
+        for (size_t i = 0; i < e.size(); ++i) {
+            REQUIRE(z[i].zone == e[i].first);
+            REQUIRE(z[i].count == e[i].second);
+        }
+        // each row is its own slot with count 1: zone asc, then hour asc
+        size_t slots = 0;
+        for (const auto& t : truth) slots += (size_t)t.second;
+        auto s = ta.topBusySlots(100000);
+        REQUIRE(s.size() == slots);
+        for (size_t i = 1; i < s.size(); ++i) {
+            bool ordered = s[i - 1].zone < s[i].zone || (s[i - 1].zone == s[i].zone && s[i - 1].hour < s[i].hour);
+            REQUIRE(ordered);
+        }
+        // a shallow query agrees with the deep one
+        auto top = ta.topZones(5);
+        for (size_t i = 0; i < top.size(); ++i) REQUIRE(top[i].zone == e[i].first);
+    };
+
+    TripAnalyzer ta;
+    ta.ingestFile(path);
+    check(ta);
+
+    // new zones land between existing names; cached ranks must extend to them
+    std::vector<std::string> more = {HDR};
+    for (int i = 0; i < 500; ++i) {
+        std::string z = "Z" + std::to_string(i * 61) + "_";
+        more.push_back(std::to_string(id++) + "," + z + ",ZX,2024-01-01 10:00,1,1");
+        more.push_back(std::to_string(id++) + "," + z + ",ZX,2024-01-01 11:00,1,1");
+        truth.emplace_back(z, 2);
+    }
+    writeFile(path, more);
+    ta.appendFile(path);
+    check(ta);
+
+    std::remove(path.c_str());
+}
+
+TEST_CASE("D19 parallel full rankings match the serial order", "[D19]") {
+    const std::string path = "d19.csv";
+    std::ofstream out(path);
+    REQUIRE(out.is_open());
+    out << HDR << "\n";
+    // enough zones and slots to split, with heavy count ties and mixed prefixes
+    long long id = 0;
+    for (int i = 0; i < 140000; ++i) {
+        std::string zone = (i % 5 ? "ZONE_" : "Z") + std::to_string((i * 7919LL) % 140009);
+        for (int r = 0; r <= i % 3; ++r) {
+            int h = (r * 7 + i) % 24;
+            out << id++ << "," << zone << ",ZX,2024-01-01 " << h / 10 << h % 10 << ":00,1,1\n";
+        }
+    }
+    out.close();
+
+    AnalyzerOptions serial;
+    serial.threads = 1;
+    AnalyzerOptions parallel;
+    parallel.threads = 4;
+    TripAnalyzer a, b;
+    a.setOptions(serial);
+    b.setOptions(parallel);
+    a.ingestFile(path);
+    b.ingestFile(path);
+
+    for (int k : {std::numeric_limits<int>::max(), 100000, 20}) {
+        auto za = a.topZones(k), zb = b.topZones(k);
+        REQUIRE(za.size() == zb.size());
+        REQUIRE(sameZones(za, zb));
+        auto sa = a.topBusySlots(k), sb = b.topBusySlots(k);
+        REQUIRE(sa.size() == sb.size());
+        REQUIRE(sameSlots(sa, sb));
+    }
+    auto all = b.topZones(std::numeric_limits<int>::max());
+    REQUIRE(all.size() == 140000);
+    for (size_t i = 1; i < all.size(); ++i) {
+        bool ordered = all[i - 1].count > all[i].count ||
+                       (all[i - 1].count == all[i].count && all[i - 1].zone < all[i].zone);
+        REQUIRE(ordered);
+    }
+
+    std::remove(path.c_str());
+}
+
+TEST_CASE("D20 visitors stream the same rankings without copies", "[D20]") {
+    const std::string path = "d20.csv";
+    std::ofstream out(path);
+    REQUIRE(out.is_open());
+    out << HDR << "\n";
+    long long id = 0;
+    for (int i = 0; i < 140000; ++i) {
+        std::string zone = "ZONE_" + std::to_string((i * 7919LL) % 140009);
+        for (int r = 0; r <= i % 4; ++r) out << id++ << "," << zone << ",ZX,2024-01-01 1" << r << ":00,1,1\n";
+    }
+    out.close();
+
+    auto check = [&](TripAnalyzer& ta) {
+        for (int k : {std::numeric_limits<int>::max(), 50000, 7}) {
+            std::vector<ZoneCount> zones;
+            ta.visitTopZones(k, [&](std::string_view z, long long c) { zones.push_back({std::string(z), c}); });
+            REQUIRE(sameZones(zones, ta.topZones(k)));
+            std::vector<SlotCount> slots;
+            ta.visitTopBusySlots(k, [&](std::string_view z, int h, long long c) {
+                slots.push_back({std::string(z), h, c});
+            });
+            REQUIRE(sameSlots(slots, ta.topBusySlots(k)));
+        }
+        int calls = 0;
+        ta.visitTopZones(0, [&](std::string_view, long long) { ++calls; });
+        REQUIRE(calls == 0);
+    };
+
+    AnalyzerOptions opts;
+    opts.threads = 4;
+    TripAnalyzer parallel;
+    parallel.setOptions(opts);
+    parallel.ingestFile(path);
+    check(parallel);
+
+    opts.threads = 1;
+    TripAnalyzer serial;
+    serial.setOptions(opts);
+    serial.ingestFile(path);
+    check(serial);
+
+    // approximate mode visits the sketch ranking
+    opts.approxCapacity = 1000;
+    TripAnalyzer approx;
+    approx.setOptions(opts);
+    approx.ingestFile(path);
+    check(approx);
+
+    std::remove(path.c_str());
+}
+
+static std::string slurp(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+TEST_CASE("D21 report writer output formats", "[D21]") {
+    const std::string csv = "d21.csv", out = "d21.out";
+    writeFile(csv, {HDR,
+                    "1,ZONE_B,ZX,2024-01-01 08:00,1,1",
+                    "2,ZONE_B,ZX,2024-01-01 08:00,1,1",
+                    "3,ZONE_C,ZX,2024-01-01 09:00,1,1",
+                    "4,ZONE_A,ZX,2024-01-01 23:00,1,1"});
+    TripAnalyzer ta;
+    ta.ingestFile(csv);
+
+    auto render = [&](ReportFormat format, auto&& body) {
+        FILE* f = std::fopen(out.c_str(), "wb");
+        REQUIRE(f);
+        {
+            ReportWriter w(fileno(f), format);
+            body(w);
+            REQUIRE(w.flush());
+        }
+        std::fclose(f);
+        return slurp(out);
+    };
+
+    SECTION("text matches the iostream report byte for byte") {
+        std::string expect = "TOP_ZONES\n";
+        for (const auto& z : ta.topZones(10)) expect += z.zone + "," + std::to_string(z.count) + "\n";
+        expect += "TOP_SLOTS\n";
+        for (const auto& s : ta.topBusySlots(10))
+            expect += s.zone + "," + std::to_string(s.hour) + "," + std::to_string(s.count) + "\n";
+
+        REQUIRE(render(ReportFormat::Text, [&](ReportWriter& w) {
+                    w.writeZones(ta, 10);
+                    w.writeSlots(ta, 10);
+                }) == expect);
+        REQUIRE(render(ReportFormat::Text, [&](ReportWriter& w) {
+                    w.writeZones(ta.topZones(10));
+                    w.writeSlots(ta.topBusySlots(10));
+                }) == expect);
+    }
+
+    SECTION("csv quotes names that need it") {
+        std::string got = render(ReportFormat::Csv, [&](ReportWriter& w) {
+            w.writeZones({{"A,B", 3}, {"say \"hi\"", 2}, {"plain", 1}});
+            w.writeSlots({{"line\nbreak", 7, 4}});
+        });
+        REQUIRE(got == "zone,count\n\"A,B\",3\n\"say \"\"hi\"\"\",2\nplain,1\n"
+                       "zone,hour,count\n\"line\nbreak\",7,4\n");
+        REQUIRE(render(ReportFormat::Csv, [&](ReportWriter& w) { w.writeZones(ta, 1); }) == "zone,count\nZONE_B,2\n");
+    }
+
+    SECTION("binary records decode back") {
+        std::string got = render(ReportFormat::Binary, [&](ReportWriter& w) {
+            w.writeZones(ta, 10);
+            w.writeSlots(ta, 10);
+        });
+        REQUIRE(got.compare(0, 8, "TRIPRPT1") == 0);
+        auto le = [&](size_t at, int bytes) {
+            unsigned long long v = 0;
+            for (int i = 0; i < bytes; ++i) v |= (unsigned long long)(unsigned char)got[at + i] << (8 * i);
+            return v;
+        };
+        std::vector<ZoneCount> zones;
+        std::vector<SlotCount> slots;
+        for (size_t p = 8; p < got.size();) {
+            char tag = got[p];
+            size_t len = (size_t)le(p + 1, 4);
+            std::string name = got.substr(p + 5, len);
+            p += 5 + len;
+            if (tag == 'Z') {
+                zones.push_back({name, (long long)le(p, 8)});
+                p += 8;
+            } else {
+                REQUIRE(tag == 'S');
+                slots.push_back({name, (int)le(p, 1), (long long)le(p + 1, 8)});
+                p += 9;
+            }
+        }
+        REQUIRE(sameZones(zones, ta.topZones(10)));
+        REQUIRE(sameSlots(slots, ta.topBusySlots(10)));
+    }
+
+    SECTION("entries larger than the buffer and many small ones") {
+        std::vector<ZoneCount> big = {{std::string(3 << 20, 'x'), 5}};
+        for (int i = 0; i < 100000; ++i) big.push_back({"Z" + std::to_string(i), -i});
+        std::string expect = "TOP_ZONES\n";
+        for (const auto& z : big) expect += z.zone + "," + std::to_string(z.count) + "\n";
+        REQUIRE(render(ReportFormat::Text, [&](ReportWriter& w) { w.writeZones(big); }) == expect);
+    }
+
+    std::remove(csv.c_str());
+    std::remove(out.c_str());
+}
+
+TEST_CASE("D22 TripID dedup counts replayed rows once", "[D22]") {
+    const std::string path = "d22.csv", again = "d22b.csv";
+    // dense IDs (the first ones go to the sparse set until the bitmap can
+    // grow down over them), sparse ones far apart, a descending run, and IDs
+    // that are not plain integers
+    std::vector<std::string> rows = {"1010000,ZONE_H,ZX,2024-01-01 07:00,1,1"};
+    for (int i = 0; i < 5000; ++i) rows.push_back(std::to_string(1000001 + i) + ",ZONE_A,ZX,2024-01-01 08:00,1,1");
+    for (long long i = 0; i < 3000; ++i)
+        rows.push_back(std::to_string(i * 1000000007LL + (i % 2 ? 3 : 9000000000000LL)) + ",ZONE_B,ZX,2024-01-01 09:00,1,1");
+    for (int i = 900000; i > 800000; i -= 2) rows.push_back(std::to_string(i) + ",ZONE_C,ZX,2024-01-01 10:00,1,1");
+    rows.push_back("\"4242\",ZONE_D,ZX,2024-01-01 11:00,1,1");
+    rows.push_back("T-1,ZONE_E,ZX,2024-01-01 12:00,1,1");
+    rows.push_back(",ZONE_E,ZX,2024-01-01 12:00,1,1");
+
+    // the replay: everything three times, in order, plus an invalid row
+    // whose ID must not be claimed
+    std::vector<std::string> replay = {HDR, "77,ZONE_X,ZX,NOT_A_DATE,1,1", "77,ZONE_F,ZX,2024-01-01 13:00,1,1"};
+    for (int rep = 0; rep < 3; ++rep) replay.insert(replay.end(), rows.begin(), rows.end());
+    writeFile(path, replay);
+
+    AnalyzerOptions opts;
+    opts.dedupTripIds = true;
+    opts.threads = 4;               // ignored: dedup ingest is serial
+    opts.parallelMinBytes = 0;
+    TripAnalyzer ta;
+    ta.setOptions(opts);
+    ta.ingestFile(path);
+
+    auto expect = [&](long long e) {
+        auto z = ta.topZones(10);
+        auto count = [&](const std::string& name) {
+            for (const auto& x : z)
+                if (x.zone == name) return x.count;
+            return 0LL;
+        };
+        REQUIRE(count("ZONE_A") == 5000);
+        REQUIRE(count("ZONE_B") == 3000);
+        REQUIRE(count("ZONE_C") == 50000);
+        REQUIRE(count("ZONE_D") == 1);
+        REQUIRE(count("ZONE_E") == e);     // non-numeric IDs always count
+        REQUIRE(count("ZONE_F") == 1);
+        REQUIRE(count("ZONE_H") == 1);
+    };
+    expect(6);
+#if !defined(TRIP_INGEST_STATS) || TRIP_INGEST_STATS
+    REQUIRE(ta.ingestStats().duplicateTrips == 2 * (1 + 5000 + 3000 + 50000 + 1));
+#endif
+
+    // IDs stay seen across appends, through the stream path too
+    writeFile(again, {HDR, "1000001,ZONE_A,ZX,2024-01-01 08:00,1,1", "5,ZONE_G,ZX,2024-01-01 08:00,1,1"});
+    ta.appendFile(again);
+    std::ifstream in(again);
+    ta.appendStream(in);
+    auto z = ta.topZones(20);
+    REQUIRE(std::count_if(z.begin(), z.end(), [](const ZoneCount& x) { return x.zone == "ZONE_G" && x.count == 1; }) == 1);
+    expect(6);
+
+    // a replacing ingest forgets them
+    ta.ingestFile(again);
+    REQUIRE(sameZones(ta.topZones(5), {{"ZONE_A", 1}, {"ZONE_G", 1}}));
+
+    // without the option nothing is skipped
+    TripAnalyzer plain;
+    plain.ingestFile(path);
+    REQUIRE(plain.topZones(1)[0].count == 150000);
+
+    std::remove(path.c_str());
+    std::remove(again.c_str());
+}
+
+TEST_CASE("D23 header-driven schemas match the standard layout", "[D23]") {
+    const std::string path = "d23.csv", feed = "d23b.csv";
+
+    // the same trips in the standard layout and in a partner feed with
+    // reordered, snake_case columns, ';' and ISO 8601 stamps with seconds
+    std::vector<std::string> standard = {HDR};
+    std::vector<std::string> partner = {"fare_amount;pickup_datetime;trip_id;pickup_zone_id;distance_km;dropoff_zone_id\r"};
+    for (int i = 0; i < 3000; ++i) {
+        std::string id = std::to_string(100 + i % 2500);   // 500 replays
+        std::string zone = "ZONE" + std::to_string(i * 7 % 13), drop = "ZONE" + std::to_string(i % 5);
+        char day[3], hour[3];
+        std::snprintf(day, sizeof(day), "%02d", 1 + i % 28);
+        std::snprintf(hour, sizeof(hour), "%02d", i * 11 % 24);
+        std::string stamp = std::string("2024-02-") + day + " " + hour + ":" + std::to_string(10 + i % 50);
+        std::string km = std::to_string(i % 9) + ".5", fare = std::to_string(i % 31) + ".25";
+
+        standard.push_back(id + "," + zone + "," + drop + "," + stamp + "," + km + "," + fare);
+        std::string iso = stamp;
+        iso[10] = 'T';
+        partner.push_back(fare + ";\"" + iso + ":07\";" + id + ";" + zone + ";" + km + ";" + drop + "\r");
+    }
+    partner.push_back("1.0;2024-02-01_10:00:00;9;ZONE_BAD;1;ZX\r");     // bad datetime
+    partner.push_back("1.0;2024-02-01T10:00:00;9;ZONE_SHORT\r");        // short row
+    writeFile(path, standard);
+    writeFile(feed, partner);
+
+    AnalyzerOptions opts;
+    opts.extendedColumns = true;
+    opts.timeBuckets = true;
+    opts.dedupTripIds = true;
+    TripAnalyzer a, b;
+    a.setOptions(opts);
+    b.setOptions(opts);
+    a.ingestFile(path);
+    b.ingestFile(feed);
+
+    REQUIRE(a.topZones(100).size() == 13);
+    REQUIRE(sameZones(a.topZones(100), b.topZones(100)));
+    REQUIRE(sameSlots(a.topBusySlots(1000), b.topBusySlots(1000)));
+    REQUIRE(sameZones(a.topDropoffZones(10), b.topDropoffZones(10)));
+    auto ra = a.topRoutes(100), rb = b.topRoutes(100);
+    REQUIRE(ra.size() == rb.size());
+    for (size_t i = 0; i < ra.size(); ++i)
+        REQUIRE((ra[i].pickup == rb[i].pickup && ra[i].dropoff == rb[i].dropoff && ra[i].count == rb[i].count));
+    auto ta = a.slotTotals("ZONE3"), tb = b.slotTotals("ZONE3");
+    REQUIRE(ta.size() == tb.size());
+    for (size_t i = 0; i < ta.size(); ++i) {
+        REQUIRE(ta[i].count == tb[i].count);
+        REQUIRE(ta[i].revenue == Catch::Approx(tb[i].revenue));
+        REQUIRE(ta[i].distanceKm == Catch::Approx(tb[i].distanceKm));
+    }
+    TimeFilter f;
+    f.fromDate = 20240205;
+    f.toDate = 20240211;
+    f.fromMinute = 6 * 60;
+    REQUIRE(sameZones(a.topZones(100, f), b.topZones(100, f)));
+#if !defined(TRIP_INGEST_STATS) || TRIP_INGEST_STATS
+    REQUIRE(b.ingestStats().duplicateTrips == 500);
+    REQUIRE(b.ingestStats().badDatetime == 1);
+    REQUIRE(b.ingestStats().missingFields == 1);
+#endif
+
+    // the stream and chunked buffer paths read the header the same way,
+    // even when it is split over chunks
+    TripAnalyzer s, c;
+    std::ifstream in(feed, std::ios::binary);
+    s.ingestStream(in);
+    std::string bytes = slurp(feed);
+    for (size_t off = 0; off < bytes.size(); off += 17)
+        c.ingestBuffer(bytes.data() + off, std::min<size_t>(17, bytes.size() - off));
+    c.finishBuffer();
+    TripAnalyzer plain;
+    plain.ingestFile(path);
+    REQUIRE(sameSlots(s.topBusySlots(1000), plain.topBusySlots(1000)));
+    REQUIRE(sameSlots(c.topBusySlots(1000), plain.topBusySlots(1000)));
+
+    // headers that do not name every column keep the standard order and
+    // stamps, with their delimiter
+    writeFile(feed, {"TripID|PickupZoneID|PickupTime|a|b|c", "1|ZONE_A|ZX|2024-01-01 10:00|1|1",
+                     "2|ZONE_A|ZX|2024-01-01 11:30|1|1", "3|ZONE_A|ZX|2024-01-01T11:30|1|1"});
+    TripAnalyzer partial;
+    partial.ingestFile(feed);
+    REQUIRE(sameSlots(partial.topBusySlots(5), {{"ZONE_A", 10, 1}, {"ZONE_A", 11, 1}}));
+
+    std::remove(path.c_str());
+    std::remove(feed.c_str());
+}
+
+TEST_CASE("D23 dirty ISO rows and stray header delimiters keep the standard layout", "[D23]") {
+    const std::string path = "d23c.csv";
+    auto both = [&](const std::vector<std::string>& lines, auto check) {
+        writeFile(path, lines);
+        TripAnalyzer file;
+        file.ingestFile(path);
+        check(file);
+
+        // one byte at a time: every row goes through the pending-row path
+        std::string bytes = slurp(path);
+        TripAnalyzer buf;
+        for (char ch : bytes) buf.ingestBuffer(&ch, 1);
+        buf.finishBuffer();
+        check(buf);
+    };
+
+    // the standard header only takes "YYYY-MM-DD HH:MM"; ISO rows ahead of
+    // the valid ones are just dirty
+    both({HDR, "1,ZONE_T,ZX,2024-01-01T10:00,1,1", "2,ZONE_T,ZX,2024-01-01T10:00,1,1",
+          "3,ZONE_T,ZX,2024-01-01T10:00,1,1", "4,ZONE_A,ZX,2024-01-01 10:00,1,1"},
+         [](const TripAnalyzer& ta) {
+             REQUIRE(sameZones(ta.topZones(5), {{"ZONE_A", 1}}));
+#if !defined(TRIP_INGEST_STATS) || TRIP_INGEST_STATS
+             REQUIRE(ta.ingestStats().badDatetime == 3);
+#endif
+         });
+
+    // a renamed header takes either form, row by row
+    both({"trip_id,pickup_zone_id,dropoff_zone_id,pickup_datetime,distance_km,fare_amount",
+          "1,ZONE_A,ZX,2024-01-01T10:00:00,1,1", "2,ZONE_A,ZX,2024-01-01 11:00,1,1"},
+         [](const TripAnalyzer& ta) {
+             REQUIRE(sameSlots(ta.topBusySlots(5), {{"ZONE_A", 10, 1}, {"ZONE_A", 11, 1}}));
+         });
+
+    // ',' rows under a header with stray ';' or '|', or one split on ';'
+    const std::vector<std::string> rows = {"1,ZONE_A,ZX,2024-01-01 10:00,1,1", "2,ZONE_B,ZX,2024-01-01 11:00,1,1"};
+    for (std::string header : {std::string(HDR) + ";;;;;;", std::string("TripID|PickupZoneID,DropoffZoneID|x"),
+                               std::string("TripID;PickupZoneID;DropoffZoneID;PickupDateTime;DistanceKm;FareAmount")}) {
+        std::vector<std::string> lines = {header, ""};
+        lines.insert(lines.end(), rows.begin(), rows.end());
+        both(lines, [](const TripAnalyzer& ta) {
+            REQUIRE(sameZones(ta.topZones(5), {{"ZONE_A", 1}, {"ZONE_B", 1}}));
+        });
+    }
+
+    // while ';' rows under such a header use it
+    both({"TripID;PickupZoneID;DropoffZoneID;PickupDateTime;DistanceKm;FareAmount",
+          "1;ZONE_A;ZX;2024-01-01 10:00;1;1"},
+         [](const TripAnalyzer& ta) { REQUIRE(sameZones(ta.topZones(5), {{"ZONE_A", 1}})); });
+
+    std::remove(path.c_str());
+}
+
+TEST_CASE("D24 compressed input round-trips past the read chunk", "[D24]") {
+#if !defined(TRIP_HAVE_ZLIB) && !defined(TRIP_HAVE_ZSTD)
+    SKIP("built without zlib and zstd");
+#else
+    const std::string path = "d24.csv";
+
+    // ~3.3 MiB of rows, so the 1 MiB chunks fill partway through the last
+    // block and the inflated size is no multiple of them; no final newline
+    std::string csv = std::string(HDR) + "\n";
+    for (int i = 0; csv.size() < (3u << 20) + 333333; ++i)
+        csv += std::to_string(i) + ",ZONE_" + std::to_string((i * 37) % 997) + ",ZX,2024-01-01 " +
+               (i % 24 < 10 ? "0" : "") + std::to_string(i % 24) + ":" + std::to_string(10 + i % 50) + "," +
+               std::to_string(i % 41) + ".5," + std::to_string(i % 97) + ".25\n";
+    csv += "9999999,ZONE_LAST,ZX,2024-01-01 23:00,1.0,2.0";
+    REQUIRE(csv.size() % (1u << 20) != 0);
+    {
+        std::ofstream out(path, std::ios::binary);
+        out << csv;
+    }
+    TripAnalyzer plain;
+    plain.ingestFile(path);
+    REQUIRE(hasZone(plain.topZones(2000), "ZONE_LAST", 1));
+
+    auto check = [&](const std::string& packed, const std::string& name) {
+        {
+            std::ofstream out(name, std::ios::binary);
+            out << packed;
+        }
+        TripAnalyzer ta;
+        ta.ingestFile(name);
+        REQUIRE(sameZones(ta.topZones(2000), plain.topZones(2000)));
+        REQUIRE(sameSlots(ta.topBusySlots(30000), plain.topBusySlots(30000)));
+
+        // cut inside the stream: the rows before the cut count, the row the
+        // cut went through does not
+        {
+            std::ofstream out(name, std::ios::binary | std::ios::trunc);
+            out.write(packed.data(), (std::streamsize)(packed.size() - 10));
+        }
+        TripAnalyzer cut;
+        cut.ingestFile(name);
+        long long whole = 0, kept = 0;
+        for (const auto& z : plain.topZones(2000)) whole += z.count;
+        for (const auto& z : cut.topZones(2000)) kept += z.count;
+        REQUIRE(kept > whole / 2);
+        REQUIRE(kept < whole);
+        REQUIRE(!hasZone(cut.topZones(2000), "ZONE_LAST", 1));
+#if !defined(TRIP_INGEST_STATS) || TRIP_INGEST_STATS
+        REQUIRE(cut.ingestStats().rowsRead == (unsigned long long)kept);
+#endif
+        std::remove(name.c_str());
+    };
+
+#ifdef TRIP_HAVE_ZSTD
+    {
+        // one frame, no checksum (the ZSTD_compress default)
+        std::string packed(ZSTD_compressBound(csv.size()), '\0');
+        size_t n = ZSTD_compress(&packed[0], packed.size(), csv.data(), csv.size(), 3);
+        REQUIRE(!ZSTD_isError(n));
+        packed.resize(n);
+        check(packed, "d24.csv.zst");
+    }
+#endif
+#ifdef TRIP_HAVE_ZLIB
+    {
+        z_stream zs{};
+        REQUIRE(deflateInit2(&zs, 6, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) == Z_OK);
+        std::string packed(deflateBound(&zs, (uLong)csv.size()), '\0');
+        zs.next_in = (Bytef*)csv.data();
+        zs.avail_in = (uInt)csv.size();
+        zs.next_out = (Bytef*)&packed[0];
+        zs.avail_out = (uInt)packed.size();
+        REQUIRE(deflate(&zs, Z_FINISH) == Z_STREAM_END);
+        packed.resize(zs.total_out);
+        deflateEnd(&zs);
+        check(packed, "d24.csv.gz");
+    }
+#endif
+    std::remove(path.c_str());
+#endif
+}
+
+TEST_CASE("D25 merged counts stay exact past 2^32", "[D25]") {
+    const std::string path = "d25.csv";
+    writeFile(path, {HDR, "1,ZONE_HOT,ZX,2024-01-01 05:00,1,1", "2,ZONE_HOT,ZX,2024-01-01 05:00,1,1",
+                     "3,ZONE_HOT,ZX,2024-01-01 05:00,1,1", "4,ZONE_HOT,ZX,2024-01-01 06:00,1,1",
+                     "5,ZONE_B,ZX,2024-01-01 05:00,1,1"});
+
+    // doubling by self-merge: 3 << 30 passes 2^32 in a 32-bit cell, 1 << 30
+    // (ZONE_B, ZONE_HOT at 06) stays narrow
+    TripAnalyzer ta;
+    ta.ingestFile(path);
+    for (int i = 0; i < 30; ++i) ta.merge(ta);
+
+    const long long g = 1LL << 30;
+    auto expect = [&](const TripAnalyzer& a, long long extra) {
+        REQUIRE(sameZones(a.topZones(2), {{"ZONE_HOT", 4 * g + extra}, {"ZONE_B", g}}));
+        REQUIRE(sameSlots(a.topBusySlots(3), {{"ZONE_HOT", 5, 3 * g + extra}, {"ZONE_B", 5, g}, {"ZONE_HOT", 6, g}}));
+        auto totals = a.slotTotals("ZONE_HOT");
+        REQUIRE(totals.size() == 2);
+        REQUIRE(totals[0].count == 3 * g + extra);
+        REQUIRE(totals[1].count == g);
+    };
+    expect(ta, 0);
+
+    // through the wire format into a fresh analyzer, then one more trip on
+    // the promoted row
+    TripAnalyzer other;
+    REQUIRE(other.mergeSerialized(ta.serializePartial().data(), ta.serializePartial().size()));
+    expect(other, 0);
+    writeFile(path, {HDR, "6,ZONE_HOT,ZX,2024-01-01 05:00,1,1"});
+    other.appendFile(path);
+    expect(other, 1);
+
+    std::remove(path.c_str());
+}